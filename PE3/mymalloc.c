@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include "mymalloc.h"
 
 int has_initialized = 0;
 
@@ -20,38 +21,43 @@ int has_initialized = 0;
 #define MEM_SIZE (64*1024)
 uint8_t heap[MEM_SIZE];
 
-// start and end of our own heap memory area
-void *managed_memory_start; 
+// The heap instance backed by the heap array above, used by mymalloc and myfree
+struct mymalloc_heap default_heap;
 
-// this block is stored at the start of each free and used block
-struct mem_control_block {
-  int size;
-  struct mem_control_block *next;  // Points to control block at start of next free area.
-  // Next ponter is only kept up to date for free-blocks, 
-  // as its only used by the free blocks in the free block list.
-};
-
-// pointer to start of our free list
-struct mem_control_block *free_list_start;      
+// The heap instance all block functions below operate on.
+// The mymalloc_heap_* functions point it at their instance while they run.
+struct mymalloc_heap *current_heap = &default_heap;
 
 void mymalloc_init() { 
 
 	// our memory starts at the start of the heap array
-	managed_memory_start = &heap;
+	mymalloc_heap_init(&default_heap, heap, MEM_SIZE);
+
+	// We're initialized and ready to go
+	has_initialized = 1;
+}
+
+// Set up a heap instance to allocate from the given memory area
+void mymalloc_heap_init(struct mymalloc_heap *instance, void *memory, long size) {
+	instance->managed_memory_start = memory;
+	instance->size = size;
+	instance->report_errors = 1;
+	mymalloc_heap_reset(instance);
+}
 
+// Wipe a heap instance, so the entire memory area is one free block again.
+// Everything allocated from it is released at once.
+void mymalloc_heap_reset(struct mymalloc_heap *instance) {
 	// allocate and initialize our memory control block 
 	// for the first (and at the moment only) free block
-	struct mem_control_block *m = (struct mem_control_block *)managed_memory_start;
-	m->size = MEM_SIZE - sizeof(struct mem_control_block);
+	struct mem_control_block *m = (struct mem_control_block *)instance->managed_memory_start;
+	m->size = instance->size - sizeof(struct mem_control_block);
 
 	// no next free block
 	m->next = (struct mem_control_block *)0;
 
 	// initialize the start of the free list
-	free_list_start = m;
-
-	// We're initialized and ready to go
-	has_initialized = 1;
+	instance->free_list_start = m;
 }
 
 // Was not sure how to test if a block is null, so this can be changed if syntax is incorrect. 
@@ -73,7 +79,7 @@ int block_is_free(struct mem_control_block * block){
 	}
 
 	// Iterate through all free blocks and look for a match 
-	struct mem_control_block *m = free_list_start;
+	struct mem_control_block *m = current_heap->free_list_start;
 	while(!block_is_null(m)){
 		if (m == block){
 			return 1;
@@ -93,7 +99,7 @@ struct mem_control_block* block_next_neighbour(struct mem_control_block * block)
 	}
 
 	void *block_end_address = ((void *)block) + sizeof(struct mem_control_block) + block->size;
-	void *memory_end_address = ((void *)managed_memory_start) + MEM_SIZE;
+	void *memory_end_address = ((void *)current_heap->managed_memory_start) + current_heap->size;
 
 	if (block_end_address >= memory_end_address){
 		// This is the last block, so no next neighbours. 
@@ -111,7 +117,7 @@ void block_print_all(){
 		mymalloc_init();
 	}
 	// printf("\nNUMBER\tADDRESS\t\tSIZE\tNEXT\t\tTYPE\n");
-	printf("\nfree_list_start now points at: %p", free_list_start);
+	printf("\nfree_list_start now points at: %p", current_heap->free_list_start);
 	printf("\n");
 	printf("|-------+-----------------------+-------+-----------------------+---------------|\n");
 	printf("| ID\t");
@@ -122,7 +128,7 @@ void block_print_all(){
 	printf("\n");
 	printf("|-------+-----------------------+-------+-----------------------+---------------|\n");
 
-	struct mem_control_block* current_block = managed_memory_start;
+	struct mem_control_block* current_block = current_heap->managed_memory_start;
 	int counter = 0;
 	while(!block_is_null(current_block)){
 		printf("| %d\t", counter);
@@ -158,13 +164,13 @@ struct mem_control_block* block_previous_neighbour(struct mem_control_block * bl
 		return NULL;
 	}
 
-	if (block == managed_memory_start){
+	if (block == current_heap->managed_memory_start){
 		// This is the first block, so no previous neighbour
 		return NULL;
 	}
 	
 	// Iterate through all blocks and look for given block 
-	struct mem_control_block *current_block = managed_memory_start;
+	struct mem_control_block *current_block = current_heap->managed_memory_start;
 	while(!block_is_null(current_block)){
 		struct mem_control_block* next_block = block_next_neighbour(current_block);
 
@@ -258,7 +264,7 @@ void block_combine_free_blocks(struct mem_control_block * block1, struct mem_con
 
 // Search for two consecutive free neighbour blocks. Return the first block if any exists, null pointer otherwise. 
 struct mem_control_block* block_find_two_free_neighbours(){
-	struct mem_control_block* current_block = (struct mem_control_block*)managed_memory_start;
+	struct mem_control_block* current_block = (struct mem_control_block*)current_heap->managed_memory_start;
 	
 	// Iterate through all blocks
 	while(!block_is_null(current_block)){
@@ -282,9 +288,7 @@ void *mymalloc(long numbytes) {
 		mymalloc_init();
 	}
 	// make sure numbytes is devisible by 8, for correct memory allocation.
-	while(numbytes%8 != 0){
-		numbytes++;
-	}
+	numbytes = (numbytes + 7) & ~7L;
 
 	// Calculate the size required by data and metadata
 	long total_block_size = numbytes + sizeof(struct mem_control_block);
@@ -292,8 +296,10 @@ void *mymalloc(long numbytes) {
 	// Declare variable to hold chosen block. 
 	struct mem_control_block* chosen_block = (struct mem_control_block*)0;
 
-	// Iterate through all free blocks, and choose the first with enough space
-	struct mem_control_block* current_block = free_list_start;
+	// Iterate through all free blocks, and choose the first with enough space.
+	// Remember the free block before it, as that one has to be linked past the chosen block.
+	struct mem_control_block* current_block = current_heap->free_list_start;
+	struct mem_control_block* previous_free_block = (struct mem_control_block*)0;
 	int split_chosen_block = 1;
 	while (!block_is_null(current_block)){
 		if (current_block->size >= numbytes){
@@ -301,12 +307,15 @@ void *mymalloc(long numbytes) {
 			split_chosen_block = (int)(current_block->size - numbytes - sizeof(struct mem_control_block)) > 0;
 			break;
 		}
+		previous_free_block = current_block;
 		current_block = block_next_free_block(current_block);
 	}
 
 	// Check that we found a block
 	if (block_is_null(chosen_block)){
-		printf("\nERROR: Unable to find a suitable block for allocating\n");
+		if (current_heap->report_errors){
+			printf("\nERROR: Unable to find a suitable block for allocating\n");
+		}
 		return (void *)0;
 	}
 
@@ -330,16 +339,17 @@ void *mymalloc(long numbytes) {
 		free_block->next = chosen_block_next;
 
 		// Check if chosen block was the first free block
-		if (chosen_block == free_list_start){
+		if (chosen_block == current_heap->free_list_start){
 			// Chosen block was the fist free block.  
 			// Free list needs to be updated to point to the new free block. (Not the occupied one)
-			free_list_start = free_block;
+			current_heap->free_list_start = free_block;
 		}
 
-		// Make sure the previous block also points to the free block
-		struct mem_control_block* free_block_previous_neighbour = block_previous_neighbour(free_block);
-		if (free_block_previous_neighbour != NULL){  // In case prev doesn't exist.
-			free_block_previous_neighbour->next = free_block;
+		// Make sure the previous free block also points to the free block.
+		// Using the free block found while searching keeps this constant time, 
+		// so allocating from the end of a heap is as cheap as bumping a pointer. 
+		if (!block_is_null(previous_free_block)){  // In case prev doesn't exist.
+			previous_free_block->next = free_block;
 		}
 	}
 	else{
@@ -348,16 +358,15 @@ void *mymalloc(long numbytes) {
 
 
 		// Check if chosen block was the first free block
-		if (chosen_block == free_list_start){
+		if (chosen_block == current_heap->free_list_start){
 			// Chosen block was the fist free block, which is now occupied. 
 			// Update the free list start to point to the next free block
-			free_list_start = chosen_block->next;
+			current_heap->free_list_start = chosen_block->next;
 		}
 
-		// Make sure the previous block also points to the next free block
-		struct mem_control_block* previous_neighbour = block_previous_neighbour(chosen_block);
-		if (previous_neighbour != NULL){  // In case prev doesn't exist.
-			previous_neighbour->next = chosen_block->next;
+		// Make sure the previous free block also points to the next free block
+		if (!block_is_null(previous_free_block)){  // In case prev doesn't exist.
+			previous_free_block->next = chosen_block->next;
 		}
 	}
 
@@ -384,8 +393,8 @@ void myfree(void *firstbyte) {
 	}
 	else{
 		// No previous free blocks, which means this will be the new first free block
-		block->next = free_list_start;
-		free_list_start = block;
+		block->next = current_heap->free_list_start;
+		current_heap->free_list_start = block;
 	}
 
 	// The given block is now free. 
@@ -404,6 +413,35 @@ void myfree(void *firstbyte) {
 
 }
 
+// Allocate numbytes from a heap instance.
+// Unlike mymalloc, which hands out the control block itself, this returns the memory after it,
+// so the caller can write to all of it. Returns a null pointer if the instance is full.
+void *mymalloc_heap_alloc(struct mymalloc_heap *instance, long numbytes) {
+	struct mymalloc_heap *previous_heap = current_heap;
+	current_heap = instance;
+	struct mem_control_block* block = mymalloc(numbytes);
+	current_heap = previous_heap;
+
+	if (block_is_null(block)){
+		return (void *)0;
+	}
+	return (void *)(block + 1);
+}
+
+// Free memory returned by mymalloc_heap_alloc
+void mymalloc_heap_free(struct mymalloc_heap *instance, void *pointer) {
+	struct mymalloc_heap *previous_heap = current_heap;
+	current_heap = instance;
+	myfree(((struct mem_control_block *)pointer) - 1);
+	current_heap = previous_heap;
+}
+
+// Return true if pointer is inside the memory area of the heap instance
+int mymalloc_heap_owns(struct mymalloc_heap *instance, void *pointer) {
+	return pointer >= instance->managed_memory_start && 
+		pointer < instance->managed_memory_start + instance->size;
+}
+
 // Tests the myalloc, by allocating 20 bytes.
 // To test the padding of 8 bytes intervals
 void mymalloc_test_with_20_bytes(){
@@ -442,7 +480,7 @@ void mymalloc_test_with_first_block_size(){
 	printf("We should start with only one block of free memory.");
 	block_print_all();
 
-	int size = ((struct mem_control_block*)managed_memory_start)->size;
+	int size = ((struct mem_control_block*)current_heap->managed_memory_start)->size;
 
 	printf("\nAllocating %i bytes of memory (block_0->size). ", size);
 	printf("This is in other words the entire size of the free block. ");
@@ -493,7 +531,7 @@ void myfree_test_with_one_occupied(){
 	}
 
 	// Retrieve the first block
-	struct mem_control_block* first_block = (struct mem_control_block*)managed_memory_start;
+	struct mem_control_block* first_block = (struct mem_control_block*)current_heap->managed_memory_start;
 	int size = first_block->size;
 
 	mymalloc(size);
@@ -519,7 +557,7 @@ void myfree_test_with_previous_free_next_occupied(){
 	}
 
 	// Retrieve the first block
-	struct mem_control_block* first_block = (struct mem_control_block*)managed_memory_start;
+	struct mem_control_block* first_block = (struct mem_control_block*)current_heap->managed_memory_start;
 	int size = first_block->size;
 
 	// Allocate three blocks of memory
@@ -553,7 +591,7 @@ void myfree_test_with_previous_occupied_next_occupied(){
 	}
 
 	// Retrieve the first block
-	struct mem_control_block* first_block = (struct mem_control_block*)managed_memory_start;
+	struct mem_control_block* first_block = (struct mem_control_block*)current_heap->managed_memory_start;
 	int size = first_block->size;
 
 	// Allocate three blocks of memory
@@ -581,7 +619,7 @@ void myfree_test_with_previous_free_next_free(){
 	}
 
 	// Retrieve the first block
-	struct mem_control_block* first_block = (struct mem_control_block*)managed_memory_start;
+	struct mem_control_block* first_block = (struct mem_control_block*)current_heap->managed_memory_start;
 	int size = first_block->size;
 
 	// Allocate three blocks of memory
@@ -612,7 +650,7 @@ void myfree_test_with_previous_occupied_next_free(){
 	}
 
 	// Retrieve the first block
-	struct mem_control_block* first_block = (struct mem_control_block*)managed_memory_start;
+	struct mem_control_block* first_block = (struct mem_control_block*)current_heap->managed_memory_start;
 	int size = first_block->size;
 
 	// Allocate three blocks of memory
@@ -634,6 +672,9 @@ void myfree_test_with_previous_occupied_next_free(){
 	block_print_all();
 }
 
+// The tests can be left out, to link the allocator into other programs:
+// gcc -c -DMYMALLOC_NO_MAIN mymalloc.c
+#ifndef MYMALLOC_NO_MAIN
 int main(int argc, char **argv) {
     /* 	Uncomment the test you want to run. Only run one test at a time.
 		
@@ -656,4 +697,4 @@ int main(int argc, char **argv) {
 	myfree_test_with_previous_occupied_next_free();
     return 0;
 }
-
+#endif
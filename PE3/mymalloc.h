@@ -0,0 +1,39 @@
+#ifndef MYMALLOC_H
+#define MYMALLOC_H
+
+/*
+	Our allocator, for use in other programs.
+	Compile without the tests, and link the object file:
+		gcc -c -DMYMALLOC_NO_MAIN mymalloc.c
+*/
+
+// this block is stored at the start of each free and used block
+struct mem_control_block {
+  int size;
+  struct mem_control_block *next;  // Points to control block at start of next free area.
+  // Next ponter is only kept up to date for free-blocks,
+  // as its only used by the free blocks in the free block list.
+};
+
+// One instance of the allocator, managing its own memory area.
+// mymalloc and myfree use a 64 kB instance of their own,
+// other programs can create as many as they like with mymalloc_heap_init.
+struct mymalloc_heap {
+  void *managed_memory_start;                   // start of the memory area
+  long size;                                    // size of the memory area in bytes
+  struct mem_control_block *free_list_start;    // pointer to start of the free list
+  int report_errors;                            // print an error when an allocation does not fit
+};
+
+void mymalloc_init();
+void *mymalloc(long numbytes);
+void myfree(void *firstbyte);
+void block_print_all();
+
+void mymalloc_heap_init(struct mymalloc_heap *instance, void *memory, long size);
+void mymalloc_heap_reset(struct mymalloc_heap *instance);
+void *mymalloc_heap_alloc(struct mymalloc_heap *instance, long numbytes);
+void mymalloc_heap_free(struct mymalloc_heap *instance, void *pointer);
+int mymalloc_heap_owns(struct mymalloc_heap *instance, void *pointer);
+
+#endif
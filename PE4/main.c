@@ -1,3 +1,4 @@
+#define _GNU_SOURCE    // For sched_setaffinity and the CPU_SET macros
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,17 +8,60 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "../PE3/mymalloc.h"
+
+// WISH allocates each command line from our own allocator in PE3, so build both:
+// gcc -DMYMALLOC_NO_MAIN main.c ../PE3/mymalloc.c -o main
 
 char **parse_input_to_arguments(char* input);
-char* scan_input();
 int get_redirection_index(char** arguments);
 char** get_command_with_parameters(char** arguments);
 void execute_command(char** arguments);
 void execute_with_output_redirection(char** arguments, int redirection_index);
 void execute_with_input_redirection(char** arguments, int redirection_index);
 int run_internal_command(char ** arguments);
+void run_parallel(char** arguments);
+FILE* open_shell_input();
+void run_timed(char** arguments);
+void run_with_launch_settings(char** arguments);
+void apply_launch_settings();
+void set_time_log(char** arguments);
+void log_command_usage(char** arguments, double wall_seconds, int child_status, struct rusage* usage);
+int run_utility_command(char** arguments);
+int run_cached_script(char* filename, struct stat* script_stat, char* cache_path);
+void write_script_cache(char* script_path, struct stat* script_stat, char* cache_path, char*** commands, int command_count);
 void read_and_execute_script(char * filename);
+char* capture_command_output(char* command_line, size_t* length);
+char** expand_command_substitutions(char** arguments);
 void execute(char** arguments);
+void execute_expanded(char** arguments);
+void* line_alloc(size_t size);
+void* line_realloc(void* pointer, size_t size);
+void line_free(void* pointer);
+void line_arena_reset();
+void execute_line(char** arguments);
+int job_finished(pid_t pid, int child_status);
+void reap_jobs();
+void restore_child_signals();
+int run_event_loop();
+int serve(char* socket_path);
+int connect_and_run(char* socket_path, int argc, char** argv);
+int run_benchmarks(int iterations);
 void print_arguments(char** arguments);
 void print_pretty();
 void welcome();
@@ -25,67 +69,143 @@ void welcome();
 // Delimiter
 #define DELIM " \t\n"
 
+// Per command line arena
+// Everything parsed from one command line is allocated from an instance of our allocator,
+// and the whole instance is wiped once the line has been executed. Allocating is a bump
+// from the end of the arena, and freeing a single allocation is free. A line that does
+// not fit in the arena gets the rest of its memory from malloc.
+#define LINE_ARENA_SIZE (1024*1024)
+uint8_t line_arena_memory[LINE_ARENA_SIZE];
+struct mymalloc_heap line_arena;
+int line_arena_initialized = 0;
+
+void* line_alloc(size_t size){
+    if (!line_arena_initialized){
+        mymalloc_heap_init(&line_arena, line_arena_memory, LINE_ARENA_SIZE);
+        line_arena.report_errors = 0;   // Running out is expected for huge lines, we fall back to malloc
+        line_arena_initialized = 1;
+    }
+    void* pointer = mymalloc_heap_alloc(&line_arena, size);
+    if (pointer == NULL){
+        pointer = malloc(size);
+    }
+    return pointer;
+}
+
+void* line_realloc(void* pointer, size_t size){
+    if (pointer == NULL || !mymalloc_heap_owns(&line_arena, pointer)){
+        return realloc(pointer, size);
+    }
+    // The size of an arena allocation is in its control block, just before it
+    size_t old_size = (((struct mem_control_block*)pointer) - 1)->size;
+    void* moved = line_alloc(size);
+    memcpy(moved, pointer, old_size < size ? old_size : size);
+    return moved;
+}
+
+// Arena memory is released by line_arena_reset, only malloc fallbacks are freed here
+void line_free(void* pointer){
+    if (pointer != NULL && !mymalloc_heap_owns(&line_arena, pointer)){
+        free(pointer);
+    }
+}
+
+// Release everything allocated for the current command line.
+// Only call this when the line is done, as nothing allocated for it may be used afterwards.
+void line_arena_reset(){
+    if (line_arena_initialized){
+        mymalloc_heap_reset(&line_arena);
+    }
+}
+
+// Resource usage and exit status of the last external command, filled in by wait4 in execute()
+struct rusage last_rusage;
+int last_status = 0;
+
+// When set, every external command gets one line of resource usage appended to this file
+FILE* time_log = NULL;
+
+// Placement applied to launched commands in the child, between fork and exec.
+// Set by the pin, nice and ionice prefixes for the duration of the command they prefix.
+struct launch_settings {
+    int has_affinity;
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;
+    int has_ionice;
+    int io_class;
+    int io_level;
+};
+struct launch_settings launch = {0};
+
+// Commands started with a trailing '&' run in the background, and are tracked here until they finish
+#define MAX_JOBS 64
+struct job {
+    int id;             // Job number shown to the user, 0 if the slot is free
+    pid_t pid;
+    char command[256];
+};
+struct job background_jobs[MAX_JOBS];
+int next_job_id = 1;
+
+// Signal mask from before the event loop blocked SIGCHLD and SIGINT, restored in children
+sigset_t original_signal_mask;
+
+// Input the event loop has read from stdin but not executed yet, following the running line.
+// Builtins that read stdin take it from here first, see open_shell_input.
+char* pending_input = NULL;
+size_t pending_input_length = 0;
+int stdin_at_end = 0;       // A builtin read stdin to its end, so the shell has no more lines either
+
+// Seconds elapsed on the monotonic clock, used for wall time measurements
+double monotonic_seconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double timeval_seconds(struct timeval tv){
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 // Parse input string into list of arguments
 char **parse_input_to_arguments(char* input){
-    // Define a buffer of a fixed length, because we don't 
+    // Define a buffer that doubles when full, because we don't 
     // know how many arguments we are going to have. 
-    char **buffer = malloc(sizeof(char) * 1024);
+    int buffer_capacity = 1024;
+    char **buffer = line_alloc(sizeof(char*) * buffer_capacity);
 
     // Split the input using strtok, and put the results into the buffer
     char* token = strtok(input, DELIM);
     int argument_count = 0;
     while(token != (char*)NULL){
+        if (argument_count == buffer_capacity){
+            buffer_capacity *= 2;
+            buffer = line_realloc(buffer, sizeof(char*) * buffer_capacity);
+        }
         buffer[argument_count++] = token;
         token = strtok(NULL, DELIM);
     }
 
     // We now know the number of arguments, and can allocate precicely enough space
-    char** arguments = malloc(sizeof(char*) * (argument_count + 1));
+    char** arguments = line_alloc(sizeof(char*) * (argument_count + 1));
 
     // Copy over elements from buffer to arguments variable
     for (int i = 0; i < argument_count; i++)
     {
-        arguments[i] = malloc(sizeof(char) * (strlen(buffer[i]) + 1));   // Allocate memory 
+        arguments[i] = line_alloc(sizeof(char) * (strlen(buffer[i]) + 1));   // Allocate memory 
         strcpy(arguments[i], buffer[i]);    // Copy value from buffer
     }
 
     // Append one null char pointer to arguments that signal end of the array
-    buffer[argument_count] = (char*)0;
+    arguments[argument_count] = (char*)0;
     
     // Free the buffer
-    free(buffer);
+    line_free(buffer);
 
     return arguments;
 }
 
-// Scan input from terminal, and return pointer to a string (char array) containing entire input.
-char* scan_input(){
-    char *buffer = malloc(sizeof(char) * 1024);
-
-    int current_char;  
-    int input_char_length = 0;
-    while (1){
-        current_char = getchar();  // Read from stdin
-        if (current_char == '\n' || current_char == EOF){  // on enter
-            buffer[input_char_length] = '\0';
-            break;
-        } else {
-            buffer[input_char_length++] = current_char;
-        }
-    }
-    
-    // Now we know exactly how much space our input needs, and can allocate precicely that amount
-    char* input = malloc(sizeof(char) * (input_char_length + 1));   // Plus one due to terminating '\0'
-
-    // Copy the string from the buffer into input variable
-    strcpy(input, buffer);
-
-    // We no longer need the buffer, so we can free it from memory
-    free(buffer);
-
-    return input;
-}
-
 // Get index of redirection symbol (< or >) in argument array. 
 // Returns -1 if arguments does not contain redirect symbol. 
 int get_redirection_index(char** arguments){
@@ -109,11 +229,11 @@ char** get_command_with_parameters(char** arguments){
         return arguments;
     }
     
-    char** result = malloc(sizeof(char*) * (redirection_index + 1));    // +1 becuase terminating array with NULL 
+    char** result = line_alloc(sizeof(char*) * (redirection_index + 1));    // +1 becuase terminating array with NULL 
 
     for (int i = 0; i < redirection_index; i++)
     {
-        result[i] = malloc(sizeof(char) * (strlen(arguments[i]) + 1));
+        result[i] = line_alloc(sizeof(char) * (strlen(arguments[i]) + 1));
         strcpy(result[i], arguments[i]);
     }
     result[redirection_index] = (char*)0;
@@ -200,40 +320,1068 @@ int run_internal_command(char ** arguments){
         printf("clear\t-\tclear console\n");
         printf("cd\t-\tchange directories\n");
         printf("wish\t-\trun scripts\n");
+        printf("time\t-\trun cmd and report its resource usage, e.g. time cmd args\n");
+        printf("timelog\t-\tlog resource usage of every command to file, 'timelog' alone stops\n");
+        printf("echo, true, false, pwd, test, printf\t-\trun in WISH without forking\n");
+        printf("pin\t-\trun cmd on the given cpus, e.g. pin 2-5,7 cmd args\n");
+        printf("nice\t-\trun cmd with adjusted niceness, e.g. nice -n 10 cmd args\n");
+        printf("ionice\t-\trun cmd with io class and level, e.g. ionice -c 2 -n 7 cmd args\n");
+        printf("jobs\t-\tlist background jobs, started with a trailing &\n");
+        printf("parallel\t-\trun cmd for each input line, e.g. parallel -j 4 [-k] cmd {} < list\n");
+        return 1;
+    }
+    else if ((strcmp(command, "parallel") == 0)){
+        run_parallel(arguments);
+        return 1;
+    }
+    else if ((strcmp(command, "time") == 0)){
+        run_timed(arguments);
+        return 1;
+    }
+    else if ((strcmp(command, "pin") == 0) || (strcmp(command, "nice") == 0) || (strcmp(command, "ionice") == 0)){
+        run_with_launch_settings(arguments);
+        return 1;
+    }
+    else if ((strcmp(command, "jobs") == 0)){
+        for (int i = 0; i < MAX_JOBS; i++){
+            if (background_jobs[i].id != 0){
+                printf("[%d] %d Running\t%s\n", background_jobs[i].id, background_jobs[i].pid, background_jobs[i].command);
+            }
+        }
+        return 1;
+    }
+    else if ((strcmp(command, "timelog") == 0)){
+        set_time_log(arguments);
         return 1;
     }
     return 0;
 }
 
+// Run the rest of the line as a command, and report what it cost.
+// Wall time covers the whole command, the rest comes from the rusage wait4 gave us.
+// Builtins do not fork, so they only get a wall time.
+void run_timed(char** arguments){
+    if (arguments[1] == NULL){
+        printf("time: missing command\n");
+        return;
+    }
+    memset(&last_rusage, 0, sizeof(last_rusage));
+
+    double start = monotonic_seconds();
+    execute_expanded(&arguments[1]);
+    double wall = monotonic_seconds() - start;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "real\t%.6fs\n", wall);
+    fprintf(stderr, "user\t%.6fs\n", timeval_seconds(last_rusage.ru_utime));
+    fprintf(stderr, "sys\t%.6fs\n", timeval_seconds(last_rusage.ru_stime));
+    fprintf(stderr, "maxrss\t%ld KB\n", last_rusage.ru_maxrss);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n", last_rusage.ru_nvcsw, last_rusage.ru_nivcsw);
+    fprintf(stderr, "faults\t%ld minor, %ld major\n", last_rusage.ru_minflt, last_rusage.ru_majflt);
+}
+
+// Start logging resource usage of each command to the given file, or stop logging if no file is given.
+// The file is appended to, so several script runs can be collected in one log.
+void set_time_log(char** arguments){
+    if (time_log != NULL){
+        fclose(time_log);
+        time_log = NULL;
+    }
+    if (arguments[1] == NULL){
+        return;
+    }
+    time_log = fopen(arguments[1], "a");
+    if (time_log == NULL){
+        printf("Unable to open file: %s\n", arguments[1]);
+        return;
+    }
+    // Write a header if the file is new
+    if (ftell(time_log) == 0){
+        fprintf(time_log, "wall_s,user_s,sys_s,maxrss_kb,nvcsw,nivcsw,minflt,majflt,status,command\n");
+    }
+    fflush(time_log);
+}
+
+// Append one CSV line describing a finished command to the time log
+void log_command_usage(char** arguments, double wall_seconds, int child_status, struct rusage* usage){
+    int status = WIFEXITED(child_status) ? WEXITSTATUS(child_status) : 128 + WTERMSIG(child_status);
+    fprintf(time_log, "%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld,%d,",
+        wall_seconds,
+        timeval_seconds(usage->ru_utime),
+        timeval_seconds(usage->ru_stime),
+        usage->ru_maxrss,
+        usage->ru_nvcsw,
+        usage->ru_nivcsw,
+        usage->ru_minflt,
+        usage->ru_majflt,
+        status);
+    for (int i = 0; arguments[i] != NULL; i++){
+        fprintf(time_log, i == 0 ? "%s" : " %s", arguments[i]);
+    }
+    fprintf(time_log, "\n");
+    fflush(time_log);
+}
+
+// Build the argument array for one parallel job. Every "{}" in the template is
+// replaced by the input line. If there is no "{}", the line is appended as the last argument.
+char** parallel_build_job(char** template, int template_count, char* line){
+    char** job = malloc(sizeof(char*) * (template_count + 2));   // +2 for appended line and NULL
+    int replaced = 0;
+    int i;
+    for (i = 0; i < template_count; i++){
+        if (strcmp(template[i], "{}") == 0){
+            job[i] = line;
+            replaced = 1;
+        } else {
+            job[i] = template[i];
+        }
+    }
+    if (!replaced){
+        job[i++] = line;
+    }
+    job[i] = (char*)0;
+    return job;
+}
+
+// Copy everything written to a finished job's output file to our stdout, then close it.
+void parallel_flush_output(FILE* output){
+    char chunk[4096];
+    size_t n;
+    fflush(stdout);
+    rewind(output);
+    while ((n = fread(chunk, 1, sizeof(chunk), output)) > 0){
+        fwrite(chunk, 1, n, stdout);
+    }
+    fflush(stdout);
+    fclose(output);
+}
+
+// Fan a command out over input lines, keeping up to N children running at once.
+// Usage: parallel [-j N] [-k] cmd [args...] [{}] [< file]
+// -j N sets the number of job slots (defaults to the number of online cores),
+// -k keeps the output of each job grouped together instead of interleaved.
+// Input lines are read from the file after '<', or from stdin.
+// stdin as seen by the current line: the rest of what the event loop has buffered, then fd 0
+ssize_t read_shell_input(void* cookie, char* buffer, size_t size){
+    if (pending_input_length > 0){
+        size_t length = size < pending_input_length ? size : pending_input_length;
+        memcpy(buffer, pending_input, length);
+        pending_input += length;
+        pending_input_length -= length;
+        return length;
+    }
+    ssize_t received = read(STDIN_FILENO, buffer, size);
+    if (received == 0 && !isatty(STDIN_FILENO)){
+        stdin_at_end = 1;   // A terminal can be read again after ^D, a pipe or file is done
+    }
+    return received;
+}
+
+FILE* open_shell_input(){
+    cookie_io_functions_t functions = { .read = read_shell_input };
+    return fopencookie(NULL, "r", functions);
+}
+
+void run_parallel(char** arguments){
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int group_output = 0;
+    int i = 1;
+
+    // Parse options
+    while (arguments[i] != NULL && arguments[i][0] == '-'){
+        if (strcmp(arguments[i], "-j") == 0 && arguments[i+1] != NULL){
+            slots = atol(arguments[i+1]);
+            i += 2;
+        } else if (strcmp(arguments[i], "-k") == 0){
+            group_output = 1;
+            i++;
+        } else {
+            printf("parallel: unknown option %s\n", arguments[i]);
+            return;
+        }
+    }
+    if (slots < 1) slots = 1;
+
+    // Everything up to a redirection symbol is the command template
+    char** template = &arguments[i];
+    int template_count = 0;
+    while (template[template_count] != NULL && *template[template_count] != '<' && *template[template_count] != '>'){
+        template_count++;
+    }
+    if (template_count == 0){
+        printf("parallel: missing command\n");
+        return;
+    }
+
+    FILE* input = NULL;     // Without a redirection, the jobs are the lines following this one
+    if (template[template_count] != NULL){
+        if (*template[template_count] != '<' || template[template_count+1] == NULL){
+            printf("parallel: only input redirection is supported\n");
+            return;
+        }
+        input = fopen(template[template_count+1], "r");
+        if (input == NULL){
+            printf("Unable to open file: %s\n", template[template_count+1]);
+            return;
+        }
+    } else {
+        input = open_shell_input();
+    }
+
+    // One entry per slot, pid 0 means the slot is free
+    pid_t* pids = calloc(slots, sizeof(pid_t));
+    FILE** outputs = calloc(slots, sizeof(FILE*));
+    int running = 0;
+    int jobs = 0;
+    int failed = 0;
+
+    char* line = NULL;
+    size_t len = 0;
+    ssize_t read = 0;
+    while (read != -1 || running > 0){
+        // Start new jobs while we have free slots and input left
+        while (running < slots && (read = getline(&line, &len, input)) != -1){
+            if (read > 0 && line[read-1] == '\n') line[--read] = '\0';
+            if (read == 0) continue;    // Skip empty lines
+
+            int slot = 0;
+            while (pids[slot] != 0) slot++;
+
+            if (group_output){
+                outputs[slot] = tmpfile();
+            }
+            fflush(stdout);
+
+            pid_t child_pid = fork();
+            if (child_pid < 0){
+                perror("ERROR: Fork failed. \n");
+                if (outputs[slot]) fclose(outputs[slot]);
+                outputs[slot] = NULL;
+                failed++;
+                continue;
+            }
+            if (child_pid == 0){
+                // In child process
+                restore_child_signals();
+                apply_launch_settings();
+                if (group_output && outputs[slot] != NULL){
+                    dup2(fileno(outputs[slot]), STDOUT_FILENO);
+                }
+                char** job = parallel_build_job(template, template_count, line);
+                execvp(job[0], job);
+                perror("Execute failed \n");
+                exit(EXIT_FAILURE);
+            }
+            pids[slot] = child_pid;
+            running++;
+            jobs++;
+        }
+        if (running == 0) break;
+
+        // Wait for any job to finish, which frees up its slot
+        int child_status;
+        pid_t done = waitpid(-1, &child_status, 0);
+        if (done < 0) break;
+        if (job_finished(done, child_status)) continue;    // A background job, not one of ours
+        for (int slot = 0; slot < slots; slot++){
+            if (pids[slot] != done) continue;
+            pids[slot] = 0;
+            running--;
+            if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0){
+                failed++;
+            }
+            if (outputs[slot] != NULL){
+                parallel_flush_output(outputs[slot]);
+                outputs[slot] = NULL;
+            }
+            break;
+        }
+    }
+
+    if (failed > 0){
+        printf("parallel: %d of %d jobs failed\n", failed, jobs);
+    }
+    last_status = failed > 0 ? 1 << 8 : 0;     // Exit status 1 if any job failed, like a failed command
+
+    fclose(input);
+    free(line);
+    free(outputs);
+    free(pids);
+}
+
+// Parse a cpu list like "2-5,7" into a cpu set. Returns 0 if the list is malformed.
+int parse_cpu_list(char* list, cpu_set_t* cpus){
+    CPU_ZERO(cpus);
+    char* c = list;
+    while (*c != '\0'){
+        char* end;
+        long first = strtol(c, &end, 10);
+        if (end == c || first < 0) return 0;
+        long last = first;
+        if (*end == '-'){
+            c = end + 1;
+            last = strtol(c, &end, 10);
+            if (end == c || last < first) return 0;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+            CPU_SET(cpu, cpus);
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return 0;
+        c = end;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+// Handle the pin, nice and ionice prefixes. The settings are added on top of any
+// enclosing prefix, the rest of the line is executed, and the previous settings restored.
+// Prefixes combine with each other and with time and parallel, e.g. nice -n 5 pin 0-3 parallel -j 4 cmd {} < list
+void run_with_launch_settings(char** arguments){
+    struct launch_settings previous = launch;
+    char* command = arguments[0];
+    int i = 1;
+
+    if (strcmp(command, "pin") == 0){
+        if (arguments[1] == NULL || !parse_cpu_list(arguments[1], &launch.cpus)){
+            printf("pin: expected a cpu list like 2-5,7\n");
+            launch = previous;
+            return;
+        }
+        launch.has_affinity = 1;
+        i = 2;
+    }
+    else if (strcmp(command, "nice") == 0){
+        launch.has_nice = 1;
+        launch.nice = 10;   // Same default adjustment as nice(1)
+        if (arguments[1] != NULL && strcmp(arguments[1], "-n") == 0 && arguments[2] != NULL){
+            launch.nice = atoi(arguments[2]);
+            i = 3;
+        }
+    }
+    else if (strcmp(command, "ionice") == 0){
+        launch.has_ionice = 1;
+        launch.io_class = 2;    // Best effort
+        launch.io_level = 4;
+        while (arguments[i] != NULL && arguments[i+1] != NULL){
+            if (strcmp(arguments[i], "-c") == 0) launch.io_class = atoi(arguments[i+1]);
+            else if (strcmp(arguments[i], "-n") == 0) launch.io_level = atoi(arguments[i+1]);
+            else break;
+            i += 2;
+        }
+        if (launch.io_class < 1 || launch.io_class > 3 || launch.io_level < 0 || launch.io_level > 7){
+            printf("ionice: class must be 1-3 and level 0-7\n");
+            launch = previous;
+            return;
+        }
+    }
+
+    if (arguments[i] == NULL){
+        printf("%s: missing command\n", command);
+    } else {
+        execute_expanded(&arguments[i]);
+    }
+    launch = previous;
+}
+
+// Apply the current launch settings to this process. Only called in a forked child,
+// so the shell itself keeps its own placement and priority.
+void apply_launch_settings(){
+    if (launch.has_affinity && sched_setaffinity(0, sizeof(launch.cpus), &launch.cpus) == -1){
+        perror("pin: sched_setaffinity failed");
+    }
+    if (launch.has_nice){
+        errno = 0;
+        if (nice(launch.nice) == -1 && errno != 0){
+            perror("nice failed");
+        }
+    }
+    if (launch.has_ionice){
+        // IOPRIO_WHO_PROCESS, and the class in the top bits above the 13 bit level
+        int priority = (launch.io_class << 13) | launch.io_level;
+        if (syscall(SYS_ioprio_set, 1, 0, priority) == -1){
+            perror("ionice: ioprio_set failed");
+        }
+    }
+}
+
+// Print arguments separated by spaces. -n suppresses the trailing newline.
+int utility_echo(int argc, char** argv){
+    int i = 1;
+    int newline = 1;
+    if (argc > 1 && strcmp(argv[1], "-n") == 0){
+        newline = 0;
+        i++;
+    }
+    for (; i < argc; i++){
+        fputs(argv[i], stdout);
+        if (i < argc - 1) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+int utility_pwd(int argc, char** argv){
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL){
+        perror("getcwd() error");
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return 0;
+}
+
+// Evaluate a single test expression of one, two or three arguments. Returns 1 if true.
+int utility_test_expression(int argc, char** argv){
+    struct stat file_stat;
+    if (argc == 0) return 0;
+    if (argc == 1) return argv[0][0] != '\0';
+    if (strcmp(argv[0], "!") == 0) return !utility_test_expression(argc - 1, argv + 1);
+    if (argc == 2){
+        char* operator = argv[0];
+        char* operand = argv[1];
+        if (strcmp(operator, "-z") == 0) return operand[0] == '\0';
+        if (strcmp(operator, "-n") == 0) return operand[0] != '\0';
+        if (strcmp(operator, "-e") == 0) return stat(operand, &file_stat) == 0;
+        if (strcmp(operator, "-f") == 0) return stat(operand, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+        if (strcmp(operator, "-d") == 0) return stat(operand, &file_stat) == 0 && S_ISDIR(file_stat.st_mode);
+        if (strcmp(operator, "-r") == 0) return access(operand, R_OK) == 0;
+        if (strcmp(operator, "-w") == 0) return access(operand, W_OK) == 0;
+        if (strcmp(operator, "-x") == 0) return access(operand, X_OK) == 0;
+        if (strcmp(operator, "-s") == 0) return stat(operand, &file_stat) == 0 && file_stat.st_size > 0;
+        return -1;
+    }
+    if (argc == 3){
+        char* left = argv[0];
+        char* operator = argv[1];
+        char* right = argv[2];
+        if (strcmp(operator, "=") == 0) return strcmp(left, right) == 0;
+        if (strcmp(operator, "!=") == 0) return strcmp(left, right) != 0;
+        long a = atol(left);
+        long b = atol(right);
+        if (strcmp(operator, "-eq") == 0) return a == b;
+        if (strcmp(operator, "-ne") == 0) return a != b;
+        if (strcmp(operator, "-lt") == 0) return a < b;
+        if (strcmp(operator, "-le") == 0) return a <= b;
+        if (strcmp(operator, "-gt") == 0) return a > b;
+        if (strcmp(operator, "-ge") == 0) return a >= b;
+    }
+    return -1;
+}
+
+// Exit status 0 if the expression is true, 1 if false, 2 if it could not be understood
+int utility_test(int argc, char** argv){
+    int result = utility_test_expression(argc - 1, argv + 1);
+    if (result < 0){
+        printf("test: unsupported expression\n");
+        return 2;
+    }
+    return !result;
+}
+
+// Write a string to stdout, interpreting backslash escapes
+void utility_print_escaped(char* string, int length){
+    for (int i = 0; i < length; i++){
+        if (string[i] != '\\' || i + 1 >= length){
+            putchar(string[i]);
+            continue;
+        }
+        switch (string[++i]){
+            case 'n': putchar('\n'); break;
+            case 't': putchar('\t'); break;
+            case 'r': putchar('\r'); break;
+            case '\\': putchar('\\'); break;
+            default: putchar('\\'); putchar(string[i]); break;
+        }
+    }
+}
+
+// printf with %s, %d, %i, %u, %x, %c and %% conversions. Like the shell utility,
+// the format is reused until all arguments are consumed.
+int utility_printf(int argc, char** argv){
+    if (argc < 2){
+        printf("printf: missing format\n");
+        return 1;
+    }
+    char* format = argv[1];
+    int next = 2;
+    do {
+        int used_argument = 0;
+        for (char* c = format; *c != '\0'; c++){
+            if (*c != '%'){
+                char* end = strchr(c, '%');
+                int length = end == NULL ? (int)strlen(c) : (int)(end - c);
+                utility_print_escaped(c, length);
+                c += length - 1;
+                continue;
+            }
+            c++;
+            char* argument = next < argc ? argv[next] : NULL;
+            switch (*c){
+                case '%': putchar('%'); continue;
+                case 's': printf("%s", argument ? argument : ""); break;
+                case 'c': if (argument) putchar(argument[0]); break;
+                case 'd':
+                case 'i': printf("%ld", argument ? atol(argument) : 0L); break;
+                case 'u': printf("%lu", argument ? strtoul(argument, NULL, 10) : 0UL); break;
+                case 'x': printf("%lx", argument ? strtoul(argument, NULL, 10) : 0UL); break;
+                case '\0': putchar('%'); c--; continue;
+                default: putchar('%'); putchar(*c); continue;
+            }
+            if (argument){
+                next++;
+                used_argument = 1;
+            }
+        }
+        if (!used_argument) break;
+    } while (next < argc);
+    return 0;
+}
+
+// Run common utilities inside WISH, to save a fork+exec for each of them.
+// Redirection is honoured by pointing stdin/stdout at the file for the duration of the command,
+// and restoring the original descriptors afterwards.
+// Returns 1 if the command was handled here, 0 if it should be executed as an external command.
+int run_utility_command(char** arguments){
+    int (*utility)(int, char**) = NULL;
+    char* command = arguments[0];
+    if (strcmp(command, "echo") == 0) utility = utility_echo;
+    else if (strcmp(command, "pwd") == 0) utility = utility_pwd;
+    else if (strcmp(command, "test") == 0) utility = utility_test;
+    else if (strcmp(command, "printf") == 0) utility = utility_printf;
+    else if (strcmp(command, "true") == 0 || strcmp(command, "false") == 0) utility = NULL;
+    else return 0;
+
+    // No child to wait for, so the time log only gets the wall time and an empty rusage
+    double start = monotonic_seconds();
+    memset(&last_rusage, 0, sizeof(last_rusage));
+
+    int redirection_index = get_redirection_index(arguments);
+    int argc = redirection_index > 0 ? redirection_index : 0;
+    if (redirection_index <= 0){
+        while (arguments[argc] != NULL) argc++;
+    }
+
+    // Redirect in process. Output redirection also takes stderr, like execute_with_output_redirection.
+    int original_stdin = -1;
+    int original_stdout = -1;
+    int original_stderr = -1;
+    if (redirection_index > 0){
+        const char* filename = arguments[redirection_index+1];
+        int output = *arguments[redirection_index] == '>';
+        int file_descriptor = filename == NULL ? -1 :
+            output ? open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666) : open(filename, O_RDONLY);
+        if (file_descriptor == -1){
+            printf("Unable to open file: %s\n", filename);
+            last_status = 1 << 8;
+            if (time_log != NULL){
+                log_command_usage(arguments, monotonic_seconds() - start, last_status, &last_rusage);
+            }
+            return 1;
+        }
+        fflush(stdout);
+        fflush(stderr);
+        if (output){
+            original_stdout = dup(STDOUT_FILENO);
+            original_stderr = dup(STDERR_FILENO);
+            dup2(file_descriptor, STDOUT_FILENO);
+            dup2(file_descriptor, STDERR_FILENO);
+        } else {
+            original_stdin = dup(STDIN_FILENO);
+            dup2(file_descriptor, STDIN_FILENO);
+        }
+        close(file_descriptor);
+    }
+
+    int status;
+    if (utility != NULL){
+        status = utility(argc, arguments);
+    } else {
+        status = strcmp(command, "false") == 0;
+    }
+    // Store like a wait status, so it reads the same as an external command's
+    last_status = (status & 0xff) << 8;
+
+    // Return io to original
+    fflush(stdout);
+    fflush(stderr);
+    if (original_stdout != -1){
+        dup2(original_stdout, STDOUT_FILENO);
+        dup2(original_stderr, STDERR_FILENO);
+        close(original_stdout);
+        close(original_stderr);
+    }
+    if (original_stdin != -1){
+        dup2(original_stdin, STDIN_FILENO);
+        close(original_stdin);
+        clearerr(stdin);
+    }
+    if (time_log != NULL){
+        log_command_usage(arguments, monotonic_seconds() - start, last_status, &last_rusage);
+    }
+    return 1;
+}
+
+// Scripts are cached in parsed form, so later runs can skip parsing.
+// A cache file starts with this header, followed by the script path (path_length bytes, no '\0'),
+// and then each command as a uint32_t argument count followed by its '\0' terminated arguments.
+// The cache is only used if the path, modification time and size all match the script.
+#define SCRIPT_CACHE_MAGIC "WSHC"
+#define SCRIPT_CACHE_VERSION 1
+
+struct script_cache_header {
+    char magic[4];
+    uint32_t version;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t command_count;
+    uint32_t argument_count;   // Sum of arguments over all commands
+    uint32_t path_length;
+    uint32_t data_length;      // Bytes of command data after the path
+};
+
+// Find the cache file for a script, from a hash of its absolute path.
+// The directory is $WISH_CACHE_DIR, or /tmp/wish-cache-<uid>. Returns 0 if caching is not possible.
+// Cached commands are executed, so the directory must be ours and writable by no one else,
+// or another user could create it first and plant cache files for our scripts.
+int script_cache_path(char* script_path, char* cache_path){
+    if (getenv("WISH_NO_CACHE") != NULL){
+        return 0;
+    }
+    char directory[PATH_MAX];
+    char* configured = getenv("WISH_CACHE_DIR");
+    if (configured != NULL){
+        snprintf(directory, sizeof(directory), "%s", configured);
+    } else {
+        snprintf(directory, sizeof(directory), "/tmp/wish-cache-%d", (int)getuid());
+    }
+    if (mkdir(directory, 0700) == -1 && errno != EEXIST){
+        return 0;
+    }
+    struct stat directory_stat;
+    if (lstat(directory, &directory_stat) == -1 ||
+        !S_ISDIR(directory_stat.st_mode) ||
+        directory_stat.st_uid != getuid() ||
+        (directory_stat.st_mode & (S_IWGRP | S_IWOTH)) != 0){
+        return 0;
+    }
+
+    // FNV-1a hash of the path
+    uint64_t hash = 14695981039346656037ULL;
+    for (char* c = script_path; *c != '\0'; c++){
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    int length = snprintf(cache_path, PATH_MAX, "%s/%016llx.wishc", directory, (unsigned long long)hash);
+    return length > 0 && length < PATH_MAX;
+}
+
+// Map the cache file and execute the commands straight out of the mapping.
+// Returns 0 if there is no valid cache for this version of the script.
+int run_cached_script(char* script_path, struct stat* script_stat, char* cache_path){
+    int file_descriptor = open(cache_path, O_RDONLY | O_NOFOLLOW);
+    if (file_descriptor == -1){
+        return 0;
+    }
+    struct stat cache_stat;
+    if (fstat(file_descriptor, &cache_stat) == -1 ||
+        !S_ISREG(cache_stat.st_mode) ||
+        cache_stat.st_uid != getuid() ||
+        cache_stat.st_size < (off_t)sizeof(struct script_cache_header)){
+        close(file_descriptor);
+        return 0;
+    }
+    // Private writable mapping, so commands can be handed to execute() without copying
+    char* cache = mmap(NULL, cache_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file_descriptor, 0);
+    close(file_descriptor);
+    if (cache == MAP_FAILED){
+        return 0;
+    }
+
+    struct script_cache_header header;
+    memcpy(&header, cache, sizeof(header));
+    size_t path_length = strlen(script_path);
+    char* path = cache + sizeof(header);
+    char* data = path + header.path_length;
+    if (memcmp(header.magic, SCRIPT_CACHE_MAGIC, 4) != 0 ||
+        header.version != SCRIPT_CACHE_VERSION ||
+        header.mtime_sec != script_stat->st_mtim.tv_sec ||
+        header.mtime_nsec != script_stat->st_mtim.tv_nsec ||
+        header.size != script_stat->st_size ||
+        header.path_length != path_length ||
+        sizeof(header) + header.path_length + header.data_length != (size_t)cache_stat.st_size ||
+        memcmp(path, script_path, path_length) != 0){
+        munmap(cache, cache_stat.st_size);
+        return 0;
+    }
+
+    // Point one argument table into the mapping, each command terminated by NULL.
+    // Everything is checked against the header and the end of the data before anything runs,
+    // a cache that does not add up is ignored and the script parsed instead.
+    size_t slots = (size_t)header.argument_count + header.command_count;
+    char** table = malloc(sizeof(char*) * (slots > 0 ? slots : 1));
+    char*** commands = malloc(sizeof(char**) * (header.command_count > 0 ? header.command_count : 1));
+    char* end = data + header.data_length;
+    char** next_argument = table;
+    int valid = table != NULL && commands != NULL;
+    for (uint32_t i = 0; valid && i < header.command_count; i++){
+        uint32_t argc;
+        if ((size_t)(end - data) < sizeof(argc)){
+            valid = 0;
+            break;
+        }
+        memcpy(&argc, data, sizeof(argc));
+        data += sizeof(argc);
+        if (argc >= slots - (next_argument - table)){     // argc arguments and the NULL must fit
+            valid = 0;
+            break;
+        }
+        commands[i] = next_argument;
+        for (uint32_t j = 0; j < argc; j++){
+            char* terminator = memchr(data, '\0', end - data);
+            if (terminator == NULL){
+                valid = 0;
+                break;
+            }
+            *next_argument++ = data;
+            data = terminator + 1;
+        }
+        *next_argument++ = (char*)0;
+    }
+    if (!valid || data != end || next_argument != table + slots){
+        free(commands);
+        free(table);
+        munmap(cache, cache_stat.st_size);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < header.command_count; i++){
+        execute(commands[i]);
+    }
+
+    free(commands);
+    free(table);
+    munmap(cache, cache_stat.st_size);
+    return 1;
+}
+
+// Serialize the parsed commands of a script into its cache file.
+// Written to a temporary file and renamed, so concurrent runs never see half a cache.
+void write_script_cache(char* script_path, struct stat* script_stat, char* cache_path, char*** commands, int command_count){
+    struct script_cache_header header;
+    memcpy(header.magic, SCRIPT_CACHE_MAGIC, 4);
+    header.version = SCRIPT_CACHE_VERSION;
+    header.mtime_sec = script_stat->st_mtim.tv_sec;
+    header.mtime_nsec = script_stat->st_mtim.tv_nsec;
+    header.size = script_stat->st_size;
+    header.command_count = command_count;
+    header.argument_count = 0;
+    header.path_length = strlen(script_path);
+    header.data_length = 0;
+    for (int i = 0; i < command_count; i++){
+        header.data_length += sizeof(uint32_t);
+        for (int j = 0; commands[i][j] != NULL; j++){
+            header.argument_count++;
+            header.data_length += strlen(commands[i][j]) + 1;
+        }
+    }
+
+    char temporary_path[PATH_MAX + 32];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%d", cache_path, (int)getpid());
+    FILE* cache = fopen(temporary_path, "w");
+    if (cache == NULL){
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, cache);
+    fwrite(script_path, 1, header.path_length, cache);
+    for (int i = 0; i < command_count; i++){
+        uint32_t argc = 0;
+        while (commands[i][argc] != NULL) argc++;
+        fwrite(&argc, sizeof(argc), 1, cache);
+        for (uint32_t j = 0; j < argc; j++){
+            fwrite(commands[i][j], 1, strlen(commands[i][j]) + 1, cache);
+        }
+    }
+    if (fclose(cache) != 0 || rename(temporary_path, cache_path) == -1){
+        remove(temporary_path);
+    }
+}
+
 // read and execute a script
+// The parsed script is cached, see script_cache_header. On a cache hit no parsing is done at all.
 void read_and_execute_script(char * filename){
     FILE * fp;
     char * line = NULL;
     size_t len = 0;
     ssize_t read;
 
+    if (filename == NULL){
+        printf("wish: missing script\n");
+        return;
+    }
+
     fp = fopen(filename, "r");
     if (fp == NULL){
         printf("Unable to open file: %s\n", filename);
         return;
     }
-    
+
+    struct stat script_stat;
+    char script_path[PATH_MAX];
+    char cache_path[PATH_MAX];
+    int use_cache = fstat(fileno(fp), &script_stat) == 0 &&
+        realpath(filename, script_path) != NULL &&
+        script_cache_path(script_path, cache_path);
+
+    if (use_cache && run_cached_script(script_path, &script_stat, cache_path)){
+        fclose(fp);
+        return;
+    }
+
+    // Parse the whole script first, so it can be cached before any command runs
+    int command_count = 0;
+    int command_capacity = 64;
+    char*** commands = malloc(sizeof(char**) * command_capacity);
     while ((read = getline(&line, &len, fp)) != -1) {
         if (line[0] == '#'){continue;} // Handle comments
         char** arguments = parse_input_to_arguments(line);
-        execute(arguments);
-        free(arguments);
+        if (arguments[0] == NULL){  // Skip empty lines
+            line_free(arguments);
+            continue;
+        }
+        if (command_count == command_capacity){
+            command_capacity *= 2;
+            commands = realloc(commands, sizeof(char**) * command_capacity);
+        }
+        commands[command_count++] = arguments;
     }
 
     fclose(fp);
     if (line){
         free(line);
     }
+
+    if (use_cache){
+        write_script_cache(script_path, &script_stat, cache_path, commands, command_count);
+    }
+
+    for (int i = 0; i < command_count; i++){
+        execute(commands[i]);
+    }
+
+    for (int i = 0; i < command_count; i++){
+        for (int j = 0; commands[i][j] != NULL; j++){
+            line_free(commands[i][j]);
+        }
+        line_free(commands[i]);
+    }
+    free(commands);
+}
+
+// Command substitution
+// $(cmd args) is replaced by the output of the command. The inner command runs in a child
+// with its stdout on a pipe, and the output is read into a buffer that grows as needed,
+// so nothing goes through temporary files.
+
+// Run a command line in a child process and return everything it wrote to stdout.
+// The returned buffer is '\0' terminated, and its length is stored in length.
+char* capture_command_output(char* command_line, size_t* length){
+    size_t capacity = 4096;
+    char* output = malloc(capacity);
+    *length = 0;
+
+    int fd[2];
+    if (pipe(fd) == -1){
+        perror("ERROR: Creating pipe failed. \n");
+        output[0] = '\0';
+        return output;
+    }
+    fflush(stdout);     // Or the child would write our buffered output into the pipe
+    int child_pid = fork();
+    if (child_pid < 0){
+        perror("ERROR: Fork failed. \n");
+        close(fd[0]);
+        close(fd[1]);
+        output[0] = '\0';
+        return output;
+    }
+    if (child_pid == 0){
+        // In child process, run the line like the shell would, with stdout on the pipe
+        close(fd[0]);
+        dup2(fd[1], STDOUT_FILENO);
+        close(fd[1]);
+        char** arguments = parse_input_to_arguments(command_line);
+        execute_line(arguments);
+        fflush(stdout);
+        exit(WIFEXITED(last_status) ? WEXITSTATUS(last_status) : EXIT_FAILURE);
+    }
+
+    close(fd[1]);
+    ssize_t received;
+    while (1){
+        if (*length + 1 == capacity){
+            capacity *= 2;
+            output = realloc(output, capacity);
+        }
+        received = read(fd[0], output + *length, capacity - *length - 1);
+        if (received == -1 && errno == EINTR) continue;
+        if (received <= 0) break;
+        *length += received;
+    }
+    close(fd[0]);
+    output[*length] = '\0';
+
+    int child_status;
+    waitpid(child_pid, &child_status, 0);
+    last_status = child_status;
+    return output;
+}
+
+// Append a character to a growable string
+void append_char(char** string, size_t* length, size_t* capacity, char c){
+    if (*length + 1 >= *capacity){
+        *capacity *= 2;
+        *string = realloc(*string, *capacity);
+    }
+    (*string)[(*length)++] = c;
+    (*string)[*length] = '\0';
+}
+
+// Add a copy of word to a growable NULL terminated array of words
+void append_word(char*** words, int* count, int* capacity, char* word){
+    if (*count + 1 >= *capacity){
+        *capacity *= 2;
+        *words = realloc(*words, sizeof(char*) * *capacity);
+    }
+    (*words)[*count] = malloc(strlen(word) + 1);
+    strcpy((*words)[(*count)++], word);
+    (*words)[*count] = (char*)0;
+}
+
+// Replace every $(...) in the arguments with the output of the command inside it.
+// The output is split on whitespace into separate arguments, and text right before or after
+// the $(...) is joined with the first and last of them, like in other shells.
+// Returns a new argument array, or NULL if there was nothing to substitute.
+char** expand_command_substitutions(char** arguments){
+    int found = 0;
+    for (int i = 0; arguments[i] != NULL && !found; i++){
+        found = strstr(arguments[i], "$(") != NULL;
+    }
+    if (!found){
+        return NULL;
+    }
+
+    // The tokenizer has split the inner commands on whitespace, so join the line back together
+    size_t line_length = 0;
+    for (int i = 0; arguments[i] != NULL; i++) line_length += strlen(arguments[i]) + 1;
+    char* line = malloc(line_length + 1);
+    line[0] = '\0';
+    for (int i = 0; arguments[i] != NULL; i++){
+        if (i > 0) strcat(line, " ");
+        strcat(line, arguments[i]);
+    }
+
+    int word_count = 0;
+    int word_capacity = 16;
+    char** words = malloc(sizeof(char*) * word_capacity);
+    words[0] = (char*)0;
+    size_t word_length = 0;
+    size_t word_capacity_bytes = 64;
+    char* word = malloc(word_capacity_bytes);
+    word[0] = '\0';
+    int in_word = 0;
+    int unterminated = 0;
+
+    for (char* c = line; *c != '\0'; c++){
+        if (c[0] == '$' && c[1] == '('){
+            // Find the matching parenthesis, allowing nested substitutions
+            int depth = 1;
+            char* end = c + 2;
+            while (*end != '\0' && depth > 0){
+                if (*end == '(') depth++;
+                else if (*end == ')') depth--;
+                if (depth > 0) end++;
+            }
+            if (*end == '\0'){
+                printf("wish: unterminated $(\n");
+                for (int i = 0; i < word_count; i++) free(words[i]);
+                words[0] = (char*)0;
+                unterminated = 1;
+                break;
+            }
+            *end = '\0';
+            size_t output_length;
+            char* output = capture_command_output(c + 2, &output_length);
+            // Trailing newlines are dropped, so text after the $(...) joins the last word
+            while (output_length > 0 && output[output_length - 1] == '\n') output_length--;
+
+            // Split the output into words, continuing the word we are in
+            for (size_t i = 0; i < output_length; i++){
+                if (strchr(DELIM, output[i]) != NULL){
+                    if (in_word){
+                        append_word(&words, &word_count, &word_capacity, word);
+                        word_length = 0;
+                        word[0] = '\0';
+                        in_word = 0;
+                    }
+                } else {
+                    append_char(&word, &word_length, &word_capacity_bytes, output[i]);
+                    in_word = 1;
+                }
+            }
+            free(output);
+            c = end;
+        }
+        else if (strchr(DELIM, *c) != NULL){
+            if (in_word){
+                append_word(&words, &word_count, &word_capacity, word);
+                word_length = 0;
+                word[0] = '\0';
+                in_word = 0;
+            }
+        }
+        else {
+            append_char(&word, &word_length, &word_capacity_bytes, *c);
+            in_word = 1;
+        }
+    }
+    if (in_word && !unterminated){
+        append_word(&words, &word_count, &word_capacity, word);
+    }
+
+    free(word);
+    free(line);
+    return words;
 }
 
 // Execute a command given as an array of arguments
 void execute(char** arguments){
     
+    // Nothing to do for an empty line
+    if (arguments[0] == NULL){
+        return;
+    }
+
+    // Run any $(...) first, and execute the line with their output in place
+    char** expanded = expand_command_substitutions(arguments);
+    if (expanded != NULL){
+        execute_expanded(expanded);
+        for (int i = 0; expanded[i] != NULL; i++){
+            free(expanded[i]);
+        }
+        free(expanded);
+        return;
+    }
+    execute_expanded(arguments);
+}
+
+// Execute a command whose $(...) have already been replaced.
+// The substituted words are taken as they are, so output that happens to contain $(...) is never run.
+void execute_expanded(char** arguments){
+    // A substitution can leave nothing behind
+    if (arguments[0] == NULL){
+        return;
+    }
+
     // Check if the command is cd or exit, runs it.
     // SHOTGUN before external commands.
     // Not done in child process, as we want to be able to 
@@ -242,20 +1390,29 @@ void execute(char** arguments){
         // We have run an internal command, no need to continue
         return;
     }
+
+    // A trailing '&' runs the command in the background. It is removed from the
+    // arguments while forking, and put back afterwards as the caller owns the array.
+    int last = 0;
+    while (arguments[last + 1] != NULL) last++;
+    char* background = NULL;
+    if (last > 0 && strcmp(arguments[last], "&") == 0){
+        background = arguments[last];
+        arguments[last] = (char*)0;
+    }
+
+    // Common utilities are run in process, saving a fork. Not when backgrounded, as they must not block the shell.
+    if (background == NULL && run_utility_command(arguments)){
+        return;
+    }
     
     // Used to keep track of zombies, to kill off. 
     int child_status;
-    // Kills all zombies.
-    do{
-        child_status = waitpid(-1, NULL, WNOHANG);
-        if (child_status > 0){
-            // Print deceased zombie PID
-            //printf("Dead zombie: %d \n", child_status);
-        }
-            
-    } while(child_status > 0);
+    // Kills all zombies, reporting background jobs that have finished.
+    reap_jobs();
 
     // Fork process
+    double start = monotonic_seconds();
     int child_pid = fork();
 
     if (child_pid < 0){
@@ -268,6 +1425,8 @@ void execute(char** arguments){
 
     if (child_pid == 0){
         // In child process
+        restore_child_signals();
+        apply_launch_settings();
         
         int redirection_index = get_redirection_index(arguments);
         if (redirection_index <= 0){
@@ -283,9 +1442,36 @@ void execute(char** arguments){
             printf("ERROR: Redirection index returned unexpected result.\n");
         }
     }
+    else if (background != NULL){
+        // In parent process, remember the job and return to the prompt without waiting
+        arguments[last] = background;
+        int slot = 0;
+        while (slot < MAX_JOBS && background_jobs[slot].id != 0) slot++;
+        if (slot == MAX_JOBS){
+            // No room to track it, it is still reaped by reap_jobs()
+            printf("%d\n", child_pid);
+            return;
+        }
+        struct job* job = &background_jobs[slot];
+        job->id = next_job_id++;
+        job->pid = child_pid;
+        job->command[0] = '\0';
+        for (int i = 0; i < last; i++){
+            size_t length = strlen(job->command);
+            snprintf(job->command + length, sizeof(job->command) - length, i == 0 ? "%s" : " %s", arguments[i]);
+        }
+        printf("[%d] %d\n", job->id, job->pid);
+    }
     else{
         // In parent process, start loop again
-        child_pid = wait(&child_status);
+        // wait4 gives us the resource usage of the child, used by time and timelog
+        child_pid = wait4(child_pid, &child_status, 0, &last_rusage);
+        if (child_pid > 0){
+            last_status = child_status;
+            if (time_log != NULL){
+                log_command_usage(arguments, monotonic_seconds() - start, child_status, &last_rusage);
+            }
+        }
         /*
         printf("End of process %d: ", child_pid);
         if (WIFEXITED(child_status)) {
@@ -300,6 +1486,608 @@ void execute(char** arguments){
     }
     
 }
+// Run one parsed line, either a script or a single command
+void execute_line(char** arguments){
+    // Checks if it is a script we want to execute
+    if (arguments[0] != NULL && strcmp(arguments[0], "wish") == 0){
+        read_and_execute_script(arguments[1]);
+    }else {
+        execute(arguments);
+    }
+}
+
+// Command server mode
+// A long-lived WISH listens on a Unix domain socket (SOCK_SEQPACKET, so each message is one command line).
+// Clients send a command line together with their stdin, stdout and stderr as SCM_RIGHTS ancillary data.
+// Each line runs through execute() in a forked copy of the server, with those descriptors in place
+// of its own, and the copy answers with the exit status as an int. A long command therefore holds up
+// only its own client, but builtins like cd only last for that line.
+// While all SERVER_MAX_CLIENTS slots are taken, new connections wait in the listen backlog.
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_MAX_LINE 4096
+
+// Receive one command line and up to three descriptors from a client.
+// Returns the length of the line, 0 if the client hung up and -1 on error.
+ssize_t server_receive(int client, char* line, int* fds, int* fd_count){
+    struct iovec io = { .iov_base = line, .iov_len = SERVER_MAX_LINE - 1 };
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct msghdr message = {0};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t length = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+    if (length <= 0){
+        return length;
+    }
+    line[length] = '\0';
+
+    *fd_count = 0;
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)){
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS){
+            *fd_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (*fd_count > 3) *fd_count = 3;
+            memcpy(fds, CMSG_DATA(header), sizeof(int) * *fd_count);
+        }
+    }
+    return length;
+}
+
+// Execute one client command with the client's descriptors as stdin, stdout and stderr.
+// Returns the exit status of the command.
+int server_run(char* line, int* fds, int fd_count){
+    int saved[3];
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < fd_count; i++){
+        saved[i] = dup(i);
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    last_status = 0;
+    char** arguments = parse_input_to_arguments(line);
+    execute_line(arguments);
+    for (int i = 0; arguments[i] != NULL; i++){
+        line_free(arguments[i]);
+    }
+    line_free(arguments);
+
+    // Return io to original
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < fd_count; i++){
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    clearerr(stdin);
+
+    return WIFEXITED(last_status) ? WEXITSTATUS(last_status) : 128 + WTERMSIG(last_status);
+}
+
+// Listen on socket_path and serve command lines until killed
+int serve(char* socket_path){
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        printf("Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listener == -1){
+        perror("ERROR: socket failed");
+        return -1;
+    }
+    remove(socket_path);    // Remove a stale socket from an earlier server
+    // Clients run commands as us, so only we may connect: the socket is 0600,
+    // and every client is checked with SO_PEERCRED as well
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+        chmod(socket_path, 0600) == -1 ||
+        listen(listener, SOMAXCONN) == -1){
+        perror("ERROR: Unable to listen on socket");
+        close(listener);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);   // A client hanging up must not kill the server
+
+    // Finished commands are reaped through a signalfd, like in the event loop
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &handled, &original_signal_mask);
+    int signals = signalfd(-1, &handled, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signals == -1){
+        perror("ERROR: signalfd failed");
+        close(listener);
+        return -1;
+    }
+
+    // Slot 0 is the listener, slot 1 the signalfd and the rest are connected clients.
+    // running holds the pid of the command a client is waiting for, 0 when it is idle.
+    struct pollfd polled[SERVER_MAX_CLIENTS + 2];
+    pid_t running[SERVER_MAX_CLIENTS + 2] = {0};
+    int polled_count = 2;
+    polled[0].fd = listener;
+    polled[1].fd = signals;
+    polled[1].events = POLLIN;
+
+    char line[SERVER_MAX_LINE];
+    while (1){
+        // Only wait for new connections while there is a slot for them
+        polled[0].events = polled_count < SERVER_MAX_CLIENTS + 2 ? POLLIN : 0;
+        if (poll(polled, polled_count, -1) == -1){
+            if (errno == EINTR) continue;
+            perror("ERROR: poll failed");
+            break;
+        }
+        if (polled[1].revents & POLLIN){
+            struct signalfd_siginfo info;
+            while (read(signals, &info, sizeof(info)) == sizeof(info));
+            pid_t pid;
+            while ((pid = waitpid(-1, NULL, WNOHANG)) > 0){
+                // The client may send its next line again
+                for (int i = 2; i < polled_count; i++){
+                    if (running[i] == pid){
+                        running[i] = 0;
+                        polled[i].events = POLLIN;
+                    }
+                }
+            }
+        }
+        if (polled[0].revents & POLLIN){
+            int client = accept(listener, NULL, NULL);
+            struct ucred credentials;
+            socklen_t credentials_length = sizeof(credentials);
+            if (client != -1 &&
+                (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) == -1 ||
+                 credentials.uid != getuid())){
+                close(client);      // Another user
+                client = -1;
+            }
+            if (client != -1){
+                fcntl(client, F_SETFD, FD_CLOEXEC);   // Commands we launch must not inherit client sockets
+                polled[polled_count].fd = client;
+                polled[polled_count].events = POLLIN;
+                polled[polled_count].revents = 0;
+                running[polled_count] = 0;
+                polled_count++;
+            }
+        }
+        for (int i = 2; i < polled_count; i++){
+            if (polled[i].revents == 0) continue;
+
+            int fds[3];
+            int fd_count = 0;
+            ssize_t length = server_receive(polled[i].fd, line, fds, &fd_count);
+            char** first = NULL;
+            if (length > 0){
+                // 'exit' ends the client's session, not the server
+                char copy[SERVER_MAX_LINE];
+                strcpy(copy, line);
+                first = parse_input_to_arguments(copy);
+            }
+            if (length <= 0 || (first[0] != NULL && strcmp(first[0], "exit") == 0)){
+                for (int j = 0; j < fd_count; j++) close(fds[j]);
+                close(polled[i].fd);
+                polled_count--;
+                running[i] = running[polled_count];
+                polled[i--] = polled[polled_count];
+            } else {
+                fflush(stdout);
+                pid_t child_pid = fork();
+                if (child_pid < 0){
+                    perror("ERROR: Fork failed. \n");
+                    int status = 1;
+                    send(polled[i].fd, &status, sizeof(status), MSG_NOSIGNAL);
+                } else if (child_pid == 0){
+                    restore_child_signals();
+                    int status = server_run(line, fds, fd_count);
+                    send(polled[i].fd, &status, sizeof(status), MSG_NOSIGNAL);
+                    _exit(0);
+                } else {
+                    // Not polled until the command is done, so its status is the next thing the client reads
+                    running[i] = child_pid;
+                    polled[i].events = 0;
+                }
+                for (int j = 0; j < fd_count; j++) close(fds[j]);
+            }
+            if (first != NULL){
+                for (int j = 0; first[j] != NULL; j++) line_free(first[j]);
+                line_free(first);
+            }
+            line_arena_reset();
+        }
+    }
+    close(signals);
+    close(listener);
+    remove(socket_path);
+    return -1;
+}
+
+// Send one command line and our stdin, stdout and stderr to a server, and wait for its exit status
+int connect_and_run(char* socket_path, int argc, char** argv){
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        printf("Socket path too long: %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int server = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (server == -1 || connect(server, (struct sockaddr*)&address, sizeof(address)) == -1){
+        perror("ERROR: Unable to connect to server");
+        return EXIT_FAILURE;
+    }
+
+    // Join the arguments back into one command line
+    char line[SERVER_MAX_LINE];
+    size_t length = 0;
+    line[0] = '\0';
+    for (int i = 0; i < argc; i++){
+        int written = snprintf(line + length, sizeof(line) - length, i == 0 ? "%s" : " %s", argv[i]);
+        if (written < 0 || length + written >= sizeof(line)){
+            printf("Command line too long\n");
+            return EXIT_FAILURE;
+        }
+        length += written;
+    }
+
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec io = { .iov_base = line, .iov_len = length };
+    struct msghdr message = {0};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    int status = EXIT_FAILURE;
+    if (sendmsg(server, &message, 0) == -1){
+        perror("ERROR: Unable to send command");
+    } else if (recv(server, &status, sizeof(status), 0) != sizeof(status)){
+        printf("Server closed the connection\n");
+        status = EXIT_FAILURE;
+    }
+    close(server);
+    return status;
+}
+
+// Benchmark mode
+// 'main --bench [iterations]' measures the overhead of WISH itself and prints CSV on stdout:
+// launch latency of builtins and external commands, tokenizer throughput,
+// script execution rate and the cost of output redirection.
+// Latencies are per call in microseconds, throughput is in the unit given on each row.
+
+int compare_doubles(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Print one CSV row from a set of latency samples in seconds, and throughput in unit per second
+void bench_report(char* benchmark, char* variant, double* samples, int count, double throughput, char* unit){
+    qsort(samples, count, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += samples[i];
+    printf("%s,%s,%d,%.3f,%.3f,%.3f,%.1f,%s\n",
+        benchmark, variant, count,
+        samples[count / 2] * 1e6,
+        samples[(int)(count * 0.99)] * 1e6,
+        sum / count * 1e6,
+        throughput, unit);
+    fflush(stdout);
+}
+
+// Time execute() on the given command line, one sample per call
+void bench_launch(char* variant, char* line, int iterations){
+    double* samples = malloc(sizeof(double) * iterations);
+    char copy[256];
+    strcpy(copy, line);
+    char** arguments = parse_input_to_arguments(copy);
+    double total = 0;
+    for (int i = 0; i < iterations; i++){
+        double start = monotonic_seconds();
+        execute(arguments);
+        samples[i] = monotonic_seconds() - start;
+        total += samples[i];
+    }
+    bench_report("launch", variant, samples, iterations, iterations / total, "commands/s");
+    for (int i = 0; arguments[i] != NULL; i++) line_free(arguments[i]);
+    line_free(arguments);
+    line_arena_reset();
+    free(samples);
+}
+
+// Time parse_input_to_arguments on a line of the given number of tokens
+void bench_tokenizer(int tokens, int iterations){
+    size_t length = tokens * 8;
+    char* line = malloc(length + 1);
+    for (int i = 0; i < tokens; i++){
+        memcpy(line + i * 8, i % 2 ? "arg\t123 " : "--flag= ", 8);
+    }
+    line[length] = '\0';
+    char* copy = malloc(length + 1);
+
+    double* samples = malloc(sizeof(double) * iterations);
+    double total = 0;
+    for (int i = 0; i < iterations; i++){
+        memcpy(copy, line, length + 1);     // strtok writes into the input
+        double start = monotonic_seconds();
+        char** arguments = parse_input_to_arguments(copy);
+        samples[i] = monotonic_seconds() - start;
+        total += samples[i];
+        for (int j = 0; arguments[j] != NULL; j++) line_free(arguments[j]);
+        line_free(arguments);
+        line_arena_reset();     // Like the shell does after each line
+    }
+    char variant[32];
+    snprintf(variant, sizeof(variant), "%d_tokens", tokens);
+    bench_report("tokenizer", variant, samples, iterations, length * iterations / total / 1e6, "MB/s");
+    free(samples);
+    free(copy);
+    free(line);
+}
+
+// Time read_and_execute_script on a script of the given command repeated, one sample per run
+void bench_script(char* variant, char* command, int lines, int runs, int cached){
+    char path[] = "/tmp/wish_bench_XXXXXX";
+    int file_descriptor = mkstemp(path);
+    if (file_descriptor == -1){
+        perror("ERROR: Unable to create benchmark script");
+        return;
+    }
+    FILE* script = fdopen(file_descriptor, "w");
+    fprintf(script, "# benchmark script\n");
+    for (int i = 0; i < lines; i++){
+        fprintf(script, "%s\n", command);
+    }
+    fclose(script);
+
+    if (!cached) setenv("WISH_NO_CACHE", "1", 1);
+    double* samples = malloc(sizeof(double) * runs);
+    double total = 0;
+    for (int i = 0; i < runs; i++){
+        double start = monotonic_seconds();
+        read_and_execute_script(path);
+        samples[i] = monotonic_seconds() - start;
+        total += samples[i];
+    }
+    if (!cached) unsetenv("WISH_NO_CACHE");
+
+    // The script samples are whole runs, report the rate per command
+    bench_report("script", variant, samples, runs, (double)lines * runs / total, "commands/s");
+    free(samples);
+
+    // Remove the script, and its cache file if one was written
+    char script_path[PATH_MAX];
+    char cache_path[PATH_MAX];
+    if (realpath(path, script_path) != NULL && script_cache_path(script_path, cache_path)){
+        remove(cache_path);
+    }
+    remove(path);
+}
+
+int run_benchmarks(int iterations){
+    if (iterations < 1) iterations = 1;
+    int script_lines = 1000;
+    int script_runs = iterations / 100 > 5 ? iterations / 100 : 5;
+
+    printf("benchmark,variant,samples,p50_us,p99_us,mean_us,throughput,unit\n");
+
+    bench_launch("builtin_true", "true", iterations);
+    bench_launch("builtin_cd", "cd .", iterations);
+    bench_launch("external_true", "/bin/true", iterations);
+
+    bench_tokenizer(8, iterations * 10);
+    bench_tokenizer(128, iterations);
+    bench_tokenizer(65536, iterations / 100 > 5 ? iterations / 100 : 5);
+
+    bench_script("builtin_uncached", "true", script_lines, script_runs, 0);
+    bench_script("builtin_cached", "true", script_lines, script_runs, 1);
+    bench_script("external_cached", "/bin/true", script_lines / 10, script_runs, 1);
+
+    bench_launch("redirect_none", "/bin/true", iterations);
+    bench_launch("redirect_output", "/bin/true > /dev/null", iterations);
+    bench_launch("redirect_builtin_output", "true > /dev/null", iterations);
+    return 0;
+}
+
+// Mark a background job as finished and tell the user. Returns 0 if pid is not a background job.
+int job_finished(pid_t pid, int child_status){
+    for (int i = 0; i < MAX_JOBS; i++){
+        struct job* job = &background_jobs[i];
+        if (job->id == 0 || job->pid != pid) continue;
+        if (WIFEXITED(child_status)){
+            printf("[%d] Done (%d)\t%s\n", job->id, WEXITSTATUS(child_status), job->command);
+        } else {
+            printf("[%d] Killed (signal %d)\t%s\n", job->id, WTERMSIG(child_status), job->command);
+        }
+        fflush(stdout);
+        job->id = 0;
+        // Start numbering from 1 again once every job is done
+        int any_left = 0;
+        for (int j = 0; j < MAX_JOBS; j++) any_left |= background_jobs[j].id != 0;
+        if (!any_left) next_job_id = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Reap every finished child without blocking
+void reap_jobs(){
+    int child_status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &child_status, WNOHANG)) > 0){
+        job_finished(pid, child_status);
+    }
+}
+
+// Children must not inherit the signals the event loop blocks, or ctrl-c would not reach them
+void restore_child_signals(){
+    sigprocmask(SIG_SETMASK, &original_signal_mask, NULL);
+}
+
+// (Re)arm the idle timer. With TMOUT set, WISH exits after that many seconds without input, like bash.
+void arm_idle_timer(int timer, int seconds){
+    struct itimerspec timeout = {0};
+    timeout.it_value.tv_sec = seconds;
+    timerfd_settime(timer, 0, &timeout, NULL);
+}
+
+// Interactive main loop
+// Instead of blocking in a read, WISH waits in epoll for one of:
+//  - input on stdin, executed a line at a time
+//  - SIGCHLD and SIGINT through a signalfd, so background jobs are reported as soon as they
+//    finish and ctrl-c only clears the prompt instead of killing the shell
+//  - a timerfd for the TMOUT idle timeout
+// A foreground command still runs to completion before the next event is handled.
+int run_event_loop(){
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGCHLD);
+    sigaddset(&handled, SIGINT);
+    sigprocmask(SIG_BLOCK, &handled, &original_signal_mask);
+
+    int signals = signalfd(-1, &handled, SFD_CLOEXEC | SFD_NONBLOCK);
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int events = epoll_create1(EPOLL_CLOEXEC);
+    if (signals == -1 || timer == -1 || events == -1){
+        perror("ERROR: Unable to set up event loop");
+        return EXIT_FAILURE;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.fd = signals;
+    epoll_ctl(events, EPOLL_CTL_ADD, signals, &event);
+    event.data.fd = timer;
+    epoll_ctl(events, EPOLL_CTL_ADD, timer, &event);
+    event.data.fd = STDIN_FILENO;
+    // Regular files can't be polled, they are always ready so we just never wait for them
+    int stdin_always_ready = epoll_ctl(events, EPOLL_CTL_ADD, STDIN_FILENO, &event) == -1 && errno == EPERM;
+
+    int idle_timeout = getenv("TMOUT") != NULL ? atoi(getenv("TMOUT")) : 0;
+    if (idle_timeout > 0) arm_idle_timer(timer, idle_timeout);
+
+    // Input is collected here until a whole line has arrived
+    size_t input_capacity = 1024;
+    size_t input_length = 0;
+    char* input = malloc(input_capacity);
+
+    // Print working directory and $, in different colors!!
+    print_pretty();
+    fflush(stdout);
+    while (1){
+        struct epoll_event ready[3];
+        int ready_count = epoll_wait(events, ready, 3, stdin_always_ready ? 0 : -1);
+        if (ready_count == -1){
+            if (errno == EINTR) continue;
+            perror("ERROR: epoll_wait failed");
+            break;
+        }
+        int stdin_ready = stdin_always_ready;
+        for (int i = 0; i < ready_count; i++){
+            if (ready[i].data.fd == STDIN_FILENO){
+                stdin_ready = 1;
+            }
+            else if (ready[i].data.fd == signals){
+                struct signalfd_siginfo info;
+                while (read(signals, &info, sizeof(info)) == sizeof(info)){
+                    if (info.ssi_signo == SIGINT){
+                        // Drop the line being typed, and give a fresh prompt
+                        printf("\n");
+                        input_length = 0;
+                        print_pretty();
+                    } else {
+                        reap_jobs();
+                    }
+                }
+                fflush(stdout);
+            }
+            else if (ready[i].data.fd == timer){
+                printf("\ntimed out waiting for input: auto-logout\n");
+                return EXIT_SUCCESS;
+            }
+        }
+        if (!stdin_ready) continue;
+
+        if (input_length + 512 > input_capacity){
+            input_capacity *= 2;
+            input = realloc(input, input_capacity);
+        }
+        ssize_t received = read(STDIN_FILENO, input + input_length, input_capacity - input_length - 1);
+        if (received == -1 && errno == EINTR) continue;
+        int end_of_input = received <= 0;
+        if (received > 0) input_length += received;
+        if (end_of_input && input_length > 0){
+            input[input_length++] = '\n';   // Run a last line without a newline before leaving
+        }
+        if (idle_timeout > 0) arm_idle_timer(timer, idle_timeout);
+
+        // Execute every complete line we have
+        char* line = input;
+        char* newline;
+        int executed = 0;
+        while ((newline = memchr(line, '\n', input + input_length - line)) != NULL){
+            *newline = '\0';
+            char** arguments = parse_input_to_arguments(line);
+            pending_input = newline + 1;
+            pending_input_length = input + input_length - pending_input;
+
+            //print_arguments(arguments);
+
+            /*
+            Task D:
+            - Exec loads an executable file and replaces the current program image with it.
+            cd, exit, etc are not an executable file, but rather a shell builtin.
+            So the executable we want to run is the shell itself. 
+            - Instead, we can implement cd using another function: int chdir(const char *path); (found in unistd.h.), 
+            to change the directory in the current process. chdir(2) changes the workind directory of the
+            calling process to teh directeroy passed to the function.
+            - When exit() is called, we can simply use the exit() on the parent process to terminate the program.
+            */
+
+            execute_line(arguments);
+
+            // Free memory allocated to arguments
+            for (int i = 0; arguments[i] != NULL; i++){
+                line_free(arguments[i]);
+            }
+            line_free(arguments);
+            line_arena_reset();
+            // Continue after whatever the line's builtins read of the input
+            line = pending_input;
+            input_length = pending_input - input + pending_input_length;
+            pending_input = NULL;
+            pending_input_length = 0;
+            executed = 1;
+        }
+        if (stdin_at_end){
+            end_of_input = 1;
+        }
+        // Keep a partial line for the next read
+        input_length = input + input_length - line;
+        memmove(input, line, input_length);
+
+        if (end_of_input){
+            break;
+        }
+        if (executed){
+            print_pretty();
+            fflush(stdout);
+        }
+    }
+    free(input);
+    return EXIT_SUCCESS;
+}
+
 // Print the whole array of arguments, where each argument is separated by a comma 
 // Also prints the sub-array where any redirection part is removed
 void print_arguments(char** arguments){
@@ -355,38 +2143,18 @@ void welcome(){
 
 int main(int argc, char **argv) {
 
-    welcome(); // print welcome 
-    while (1){
-        // Print working directory and $, in different colors!!
-        print_pretty();
-        char* input = scan_input();
-        char** arguments = parse_input_to_arguments(input);
-        
-        //print_arguments(arguments);
-        
-        /*
-        Task D:
-        - Exec loads an executable file and replaces the current program image with it.
-        cd, exit, etc are not an executable file, but rather a shell builtin.
-        So the executable we want to run is the shell itself. 
-        - Instead, we can implement cd using another function: int chdir(const char *path); (found in unistd.h.), 
-        to change the directory in the current process. chdir(2) changes the workind directory of the
-        calling process to teh directeroy passed to the function.
-        - When exit() is called, we can simply use the exit() on the parent process to terminate the program.
-        */
-        
-        
-        // Checks if it is a script we want to execute
-        if (strcmp(arguments[0], "wish") == 0){
-            read_and_execute_script(arguments[1]);
-        }else {
-            execute(arguments);
-        }
-        
-        // Free memory allocated to arguments
-        free(arguments);
-        free(input);
+    // Headless modes: 'main --serve socket' runs a command server, 'main --connect socket cmd args' is its client
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0){
+        return serve(argv[2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    
-    return 0;
+    if (argc >= 4 && strcmp(argv[1], "--connect") == 0){
+        return connect_and_run(argv[2], argc - 3, &argv[3]);
+    }
+    // 'main --bench [iterations]' prints shell overhead benchmarks as CSV
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0){
+        return run_benchmarks(argc >= 3 ? atoi(argv[2]) : 1000);
+    }
+
+    welcome(); // print welcome 
+    return run_event_loop();
 }
\ No newline at end of file
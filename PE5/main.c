@@ -1,4 +1,6 @@
 /*PE5 InterProcessCommunication*/
+/* Build: gcc main.c -o main -lm -lpthread */
+#define _GNU_SOURCE     /* For memfd_create, vmsplice and splice */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,42 +10,221 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <sched.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
 
 /* Initalization */
 char* generate_data(size_t size);
+char* allocate_buffer(size_t size);
+void release_buffer(char* buffer, size_t size);
+int valid_buffer_kind(const char* kind);
 int unnamed_pipe(size_t size);
 int named_pipe(size_t size);
+int shared_memory_ring(size_t size);
+int spliced_pipe(size_t size, const char* sink);
+int socket_pair(size_t size, int type);
+int unix_socket(size_t size);
+int run_transport(const char* transport, size_t size, const char* sink);
+int threaded_transport(const char* transport, size_t size);
+void count_bytes_read(size_t r);
+int set_pipe_capacity(int fd);
+int start_reporter();
+int choose_placement(const char* name);
+void pin_side(int side);
+int uring_transfer(int fd, int direction, size_t size);
+double now_seconds();
+int sweep(int argc, char *argv[]);
+int pingpong(int argc, char *argv[]);
+int scale(int argc, char *argv[]);
+int framed(int argc, char *argv[]);
+int fanin(int argc, char *argv[]);
 
 
 enum {READ = 0, WRITE = 1};
-unsigned long long int cumulative_bytes_read = 0;   /* cumulative number of bytes read - For task a.*/
-unsigned long int bytes_read = 0;                   /* Bytes read since the last alarm.*/
+_Atomic unsigned long long cumulative_bytes_read = 0; /* cumulative number of bytes read - For task a.*/
+_Atomic unsigned long long* shared_bytes_read = NULL; /* Same as cumulative, in memory shared with the sweep controller */
+size_t pipe_capacity = 0;                           /* Requested pipe/FIFO capacity in bytes, 0 keeps the kernel default */
+double report_interval = 1.0;                       /* Seconds between bandwidth reports */
+const char* placement = "none";                     /* Where reader and writer are pinned, see choose_placement */
+int reader_cpu = -1, writer_cpu = -1;               /* CPUs the sides are pinned to, -1 is unpinned */
+int uring_depth = 0;                                /* Reads/writes kept in flight through io_uring, 0 uses read/write */
+int uring_queue_depth = 8;                          /* uring_depth for the uring transports */
+const char* buffer_kind = "malloc";                 /* How transfer buffers are allocated, see allocate_buffer */
 
-// Signal handler
-void sig_handler_B(int signum){
-    // TASK B 
-    printf("Bandwidth: %li\n", bytes_read);
-    bytes_read = 0; // Reset for next second.
-    alarm(1);
+/* Count bytes that have arrived at the reader */
+void count_bytes_read(size_t r){
+    /* Only the reader adds to the counters, so a relaxed load and store is enough, no locked add */
+    atomic_store_explicit(&cumulative_bytes_read, atomic_load_explicit(&cumulative_bytes_read, memory_order_relaxed) + r, memory_order_relaxed);
+    if (shared_bytes_read != NULL){
+        /* Only the reader writes it, so a plain load and store is enough */
+        atomic_store_explicit(shared_bytes_read, atomic_load_explicit(shared_bytes_read, memory_order_relaxed) + r, memory_order_relaxed);
+    }
+}
+
+/* Reporter thread
+ * Replaces the SIGALRM and SIGUSR1 handlers, which called printf from signal context and were
+ * stuck at alarm()'s whole seconds. The reader only bumps cumulative_bytes_read, and this thread
+ * samples it on a timerfd at report_interval, so the bandwidth is the difference between two
+ * samples over the measured time between them. SIGUSR1 is blocked and received through a
+ * signalfd, so no code runs in signal context at all.
+ *
+ * Every report is one line of key=value pairs, prefixed by its kind:
+ *   bandwidth time=1.000 interval=1.000 bytes=4984030000 bps=4984030000 total_bytes=4984030000
+ *   total time=3.417 total_bytes=17032014000
+ */
+void* reporter(void* arg){
+    int signals = *(int*)arg;
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct timespec period = { .tv_sec = (time_t)report_interval, .tv_nsec = (long)((report_interval - (time_t)report_interval) * 1e9) };
+    struct itimerspec schedule = { .it_interval = period, .it_value = period };
+    if (timer == -1 || timerfd_settime(timer, 0, &schedule, NULL) == -1){
+        perror("ERROR: Creating report timer failed");
+        return NULL;
+    }
+
+    double start = now_seconds();
+    double previous_time = start;
+    unsigned long long previous_bytes = atomic_load(&cumulative_bytes_read);
+    struct pollfd fds[2] = { { .fd = timer, .events = POLLIN }, { .fd = signals, .events = POLLIN } };
+    while (1){
+        if (poll(fds, 2, -1) == -1){
+            if (errno == EINTR) continue;
+            perror("ERROR: poll failed");
+            return NULL;
+        }
+        double time = now_seconds();
+        unsigned long long bytes = atomic_load(&cumulative_bytes_read);
+        if (fds[0].revents & POLLIN){
+            // TASK B
+            uint64_t expirations;
+            if (read(timer, &expirations, sizeof(expirations)) == -1) continue;
+            printf("bandwidth time=%.3f interval=%.3f bytes=%llu bps=%.0f total_bytes=%llu\n",
+                time - start, time - previous_time, bytes - previous_bytes,
+                (bytes - previous_bytes) / (time - previous_time), bytes);
+            previous_time = time;
+            previous_bytes = bytes;
+        }
+        if (fds[1].revents & POLLIN){
+            // TASK C
+            struct signalfd_siginfo info;
+            if (read(signals, &info, sizeof(info)) == -1) continue;
+            printf("total time=%.3f total_bytes=%llu\n", time - start, bytes);
+        }
+        fflush(stdout);
+    }
+    return NULL;
 }
 
-void sig_handler_C(int signum){
-    // TASK C 
-    printf("=====================================\n");
-    printf("Total number of bytes sent so far: %llu\n", cumulative_bytes_read);
-    printf("=====================================\n");
+// Start reporting the bandwidth every report_interval seconds, and the total on SIGUSR1.
+int start_reporter(){
+    /* Blocked before the thread and the transport's children exist, so they all inherit it */
+    static int signals;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signals = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (signals == -1){
+        perror("ERROR: Creating signalfd failed");
+        return -1;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reporter, &signals) != 0){
+        perror("ERROR: Creating reporter thread failed");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
 }
 
 int main(int argc, char *argv[]){
-    signal(SIGALRM, sig_handler_B); // Register signal handler for handling alarms
-    signal(SIGUSR1, sig_handler_C);  // Signal handler for handling kill - 
-    alarm(1);  // Scheduled the first alarm after 1 seconds
+    if (argc > 1 && strcmp(argv[1], "--sweep") == 0){
+        return sweep(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--pingpong") == 0){
+        return pingpong(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--scale") == 0){
+        return scale(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--framed") == 0){
+        return framed(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--fanin") == 0){
+        return fanin(argc - 1, argv + 1);
+    }
+
+    while (argc > 2 && (strcmp(argv[1], "--capacity") == 0 || strcmp(argv[1], "--interval") == 0 ||
+                        strcmp(argv[1], "--placement") == 0 || strcmp(argv[1], "--depth") == 0 ||
+                        strcmp(argv[1], "--buffers") == 0)){
+        if (strcmp(argv[1], "--capacity") == 0) pipe_capacity = strtoull(argv[2], NULL, 10);
+        else if (strcmp(argv[1], "--depth") == 0) uring_queue_depth = atoi(argv[2]);
+        else if (strcmp(argv[1], "--buffers") == 0) buffer_kind = argv[2];
+        else if (strcmp(argv[1], "--placement") == 0){
+            if (choose_placement(argv[2]) != 0) return 1;
+        }
+        else report_interval = atof(argv[2]);
+        argv[2] = argv[0];  // Drop the option, the rest is parsed as usual
+        argv += 2;
+        argc -= 2;
+    }
     
+    if (argc < 2){
+        printf("Usage: %s [--capacity <pipe bytes>] [--interval <seconds>] [--placement none|same-core|smt|same-socket|cross-socket] [--depth <io_uring depth>] [--buffers malloc|page|thp|hugetlb] <block size> [unnamed|named|uring|uring-named|shm|splice [sink file]|stream|seqpacket|unix|thread-<transport>|queue]\n", argv[0]);
+        printf("       %s --sweep [options], see --sweep --help\n", argv[0]);
+        printf("       %s --pingpong [options], see --pingpong --help\n", argv[0]);
+        printf("       %s --scale [options], see --scale --help\n", argv[0]);
+        printf("       %s --framed [options], see --framed --help\n", argv[0]);
+        printf("       %s --fanin [options], see --fanin --help\n", argv[0]);
+        return 1;
+    }
     size_t size = atoi(argv[1]);    // Byte size of each package/block
+    const char* transport = argc > 2 ? argv[2] : "unnamed";
+    if (uring_queue_depth < 1 || uring_queue_depth > 4096){
+        printf("The io_uring depth has to be between 1 and 4096\n");
+        return 1;
+    }
+    if (!valid_buffer_kind(buffer_kind)){
+        printf("Unknown buffer kind: %s\n", buffer_kind);
+        return 1;
+    }
+    if (report_interval < 0.001){
+        printf("The report interval has to be at least 0.001 seconds\n");
+        return 1;
+    }
+    if (start_reporter() != 0){     // Bandwidth every interval, total on SIGUSR1
+        return 1;
+    }
+    printf("placement name=%s reader_cpu=%d writer_cpu=%d\n", placement, reader_cpu, writer_cpu);
+    printf("buffers kind=%s\n", buffer_kind);
     
     // For testing task A, you need to uncomment marked code in unnamed_pipe()
-    int status = unnamed_pipe(size);  /* For task A, B and C */
-    //int status = named_pipe(size);      /* For task D */    
+    int status = run_transport(transport, size, argc > 3 ? argv[3] : "/dev/null");
+    if (status == 0){
+        printf("Unknown transport: %s\n", transport);
+        return 1;
+    }
     
     ////////////////////////////////
     //////////// TASK B ////////////
@@ -83,6 +264,134 @@ int main(int argc, char *argv[]){
     
     return 0;
 }
+// Run the named transport. Only returns on errors, or 0 if there is no such transport.
+int run_transport(const char* transport, size_t size, const char* sink){
+    if (strcmp(transport, "unnamed") == 0){
+        return unnamed_pipe(size);  /* For task A, B and C */
+    } else if (strcmp(transport, "named") == 0){
+        return named_pipe(size);      /* For task D */    
+    } else if (strcmp(transport, "uring") == 0){
+        uring_depth = uring_queue_depth;
+        return unnamed_pipe(size);
+    } else if (strcmp(transport, "uring-named") == 0){
+        uring_depth = uring_queue_depth;
+        return named_pipe(size);
+    } else if (strcmp(transport, "shm") == 0){
+        return shared_memory_ring(size);
+    } else if (strcmp(transport, "splice") == 0){
+        return spliced_pipe(size, sink);
+    } else if (strcmp(transport, "stream") == 0){
+        return socket_pair(size, SOCK_STREAM);
+    } else if (strcmp(transport, "seqpacket") == 0){
+        return socket_pair(size, SOCK_SEQPACKET);
+    } else if (strcmp(transport, "unix") == 0){
+        return unix_socket(size);
+    } else if (strncmp(transport, "thread-", 7) == 0 || strcmp(transport, "queue") == 0){
+        return threaded_transport(transport, size);
+    }
+    return 0;
+}
+/* Placement
+ * Pins the reader and the writer to CPUs chosen from the topology in /sys/devices/system/cpu,
+ * so runs can be compared with the two sides sharing caches or not:
+ *   none          leave it to the scheduler
+ *   same-core     both on the same logical CPU, taking turns
+ *   smt           SMT siblings, two hardware threads of one core
+ *   same-socket   two different cores of one package, sharing the last level cache
+ *   cross-socket  cores in two different packages
+ * Only CPUs we are allowed to run on are considered.
+ */
+int read_cpu_value(int cpu, const char* name){
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE* file = fopen(path, "r");
+    int value = -1;
+    if (file != NULL){
+        if (fscanf(file, "%d", &value) != 1) value = -1;
+        fclose(file);
+    }
+    return value;
+}
+
+// Set reader_cpu and writer_cpu for the named placement. Returns -1 if the machine has no such pair.
+int choose_placement(const char* name){
+    placement = name;
+    reader_cpu = writer_cpu = -1;
+    if (strcmp(name, "none") == 0) return 0;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1){
+        perror("ERROR: sched_getaffinity failed");
+        return -1;
+    }
+    for (int reader = 0; reader < CPU_SETSIZE; reader++){
+        if (!CPU_ISSET(reader, &allowed)) continue;
+        int reader_core = read_cpu_value(reader, "core_id");
+        int reader_package = read_cpu_value(reader, "physical_package_id");
+        for (int writer = reader; writer < CPU_SETSIZE; writer++){
+            if (!CPU_ISSET(writer, &allowed)) continue;
+            int same_core = read_cpu_value(writer, "core_id") == reader_core;
+            int same_package = read_cpu_value(writer, "physical_package_id") == reader_package;
+            int found;
+            if (strcmp(name, "same-core") == 0) found = writer == reader;
+            else if (strcmp(name, "smt") == 0) found = writer != reader && same_package && same_core;
+            else if (strcmp(name, "same-socket") == 0) found = same_package && !same_core;
+            else if (strcmp(name, "cross-socket") == 0) found = !same_package;
+            else {
+                printf("Unknown placement: %s\n", name);
+                return -1;
+            }
+            if (found){
+                reader_cpu = reader;
+                writer_cpu = writer;
+                return 0;
+            }
+        }
+    }
+    printf("No CPUs for placement %s on this machine\n", name);
+    return -1;
+}
+
+// Pin the calling process to the CPU chosen for its side, READ or WRITE.
+void pin_side(int side){
+    int cpu = side == READ ? reader_cpu : writer_cpu;
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1){
+        perror("ERROR: sched_setaffinity failed");
+    }
+}
+
+/* Pipe capacity
+ * Pipes hold 64 KiB by default, which limits how much a writer can get ahead of its reader.
+ * F_SETPIPE_SZ raises it, up to /proc/sys/fs/pipe-max-size for unprivileged processes.
+ * The kernel rounds the size up to a power of two pages.
+ */
+size_t pipe_max_size(){
+    size_t max = 1048576;   /* the kernel's default limit */
+    FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (file != NULL){
+        if (fscanf(file, "%zu", &max) != 1) max = 1048576;
+        fclose(file);
+    }
+    return max;
+}
+
+// Set the capacity of the pipe behind fd to pipe_capacity, if one was requested. Returns the capacity.
+int set_pipe_capacity(int fd){
+    if (pipe_capacity > 0){
+        size_t capacity = pipe_capacity;
+        size_t max = pipe_max_size();
+        if (capacity > max) capacity = max;
+        if (fcntl(fd, F_SETPIPE_SZ, (int)capacity) == -1){
+            perror("ERROR: Setting pipe capacity failed");
+        }
+    }
+    return fcntl(fd, F_GETPIPE_SZ);
+}
+
 // Establish unnamed pipe and read/write as fast as possible through the pipe.
 int unnamed_pipe(size_t size){
     /*Print the parent process pid, to use in task C*/
@@ -94,20 +403,22 @@ int unnamed_pipe(size_t size){
     /* Create Pipe and fork the process, establish communication */
     int res, fd[2]; /* child PID and descriptor */
     if (pipe (fd) == 0) {                   /* create the pipe */
+        printf("Pipe capacity: %i\n", set_pipe_capacity(fd[READ]));
         res = fork ();                      /* pipe created successfully*/
         if (res > 0) {                      /* parent process (Supposed to read)*/
+            pin_side(READ);
             close (fd[WRITE]);              /* close writing side */
             dup2 (fd[READ], 0);             /* redirect stdin from pipe */
+            if (uring_depth > 0) return uring_transfer(fd[READ], READ, size);
             int r = 0;                      /* status of read */
-            char *buff = malloc(size);
+            char *buff = allocate_buffer(size);
             while(r != -1){
                 r = read(fd[READ], buff, size);          /* Listen to the pipe */
                 if (r == -1){
                     perror("ERROR: read failed");
                     return -1;
                 }
-                bytes_read += r;
-                cumulative_bytes_read += bytes_read;
+                count_bytes_read(r);
                 /*We never use buff, and overwrite it each read as it is just fille with trash...*/
                 /** TASK A
                  * Uncomment to see cumulative number of received bytes
@@ -115,11 +426,13 @@ int unnamed_pipe(size_t size){
                 //printf("Bytes read: %llu\n", cumulative_bytes_read);
             }
             close (fd[READ]);                       /* release the descriptor */
-            free(buff); // Free the trash!
+            release_buffer(buff, size); // Free the trash!
         }
         else if (res == 0) {        /* child process (Supposed to write endlessly)*/
+            pin_side(WRITE);
             close (fd[READ]);       /* close reading side */
             dup2 (fd[WRITE], 1);    /* redirect stdout to pipe */
+            if (uring_depth > 0) return uring_transfer(fd[WRITE], WRITE, size);
             int w = 0;
             char *dummy_data = generate_data(size);
             while(w!=-1){
@@ -130,7 +443,7 @@ int unnamed_pipe(size_t size){
                 }
             }
             close (fd[WRITE]);      /* release the descriptor */
-            free(dummy_data);
+            release_buffer(dummy_data, size);
         }
         else if (res < 0){          /* if the forking failed*/
             perror("ERROR: Fork failed. \n");
@@ -164,14 +477,16 @@ int named_pipe(size_t size){
     if (status == 0) {                      /* create the pipe-file successfully */
         res = fork ();                      /* pipe created successfully*/
         if (res > 0) {                      /* parent process (Supposed to read)*/
-            
+            pin_side(READ);
             int filedes = open(pipe_name, O_RDONLY);    /* open fifo pipe with read only */
             if (filedes == -1){
                 perror("ERROR: file open failed");
                 return -1;
             }
+            printf("Pipe capacity: %i\n", set_pipe_capacity(filedes));
+            if (uring_depth > 0) return uring_transfer(filedes, READ, size);
             int r = 0;
-            char *buff = malloc(size);                  /* status of read */
+            char *buff = allocate_buffer(size);                  /* status of read */
             while(r != -1){
                 r = read(filedes, buff, size);          /* Listen to the pipe */
                 if (r == -1){
@@ -179,20 +494,21 @@ int named_pipe(size_t size){
                     return -1;
                 }
                 
-                bytes_read += r;               /* is reset every alarm */
-                cumulative_bytes_read += r;    /* cumulative no. bytes sent */
+                count_bytes_read(r);
                 /* we never use the buff, and overwrite it all the time, as it is filled with trash */
                 
             }
             close (filedes);  /* release the descriptor */
-            free(buff); // Free the trash!
+            release_buffer(buff, size); // Free the trash!
         }
         else if (res == 0) {        /* child process (Supposed to write endlessly)*/
+            pin_side(WRITE);
             int filedes = open(pipe_name, O_WRONLY);  /* open fifopipe with write only */
             if (filedes == -1){
                 perror("ERROR: file open failed");
                 return -1;
             }
+            if (uring_depth > 0) return uring_transfer(filedes, WRITE, size);
             int w = 0;
             char* dummy_data = generate_data(size);
             while(w!=-1){
@@ -202,7 +518,7 @@ int named_pipe(size_t size){
                     return -1;
                 }
             }
-            free(dummy_data);
+            release_buffer(dummy_data, size);
             close (filedes);      /* release the descriptor */
         }
         else if (res < 0){          /* if the forking failed*/
@@ -222,9 +538,2096 @@ int named_pipe(size_t size){
 
 
 }
+/* io_uring driver
+ * Moves data through the pipe and FIFO transports with io_uring instead of one read or write
+ * syscall per block. uring_depth operations are kept in flight, each on its own buffer, and
+ * registered with the ring up front so the kernel does not have to map them for every operation.
+ * Every io_uring_enter submits all the operations requeued since the last one and waits for at
+ * least one completion, and every completion seen then is handled before entering again.
+ * With several reads in flight on one pipe the blocks may complete out of order, which does not
+ * matter for the byte count.
+ * There is no liburing here, so the rings are set up with the raw syscalls.
+ */
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned sq_local_tail; /* next entry to fill, published to sq_tail by uring_enter */
+    unsigned to_submit;     /* filled but not yet taken by the kernel */
+};
+
+int uring_setup(struct uring* ring, unsigned entries){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1){
+        perror("ERROR: io_uring_setup failed");
+        return -1;
+    }
+    ring->entries = params.sq_entries;
+    ring->sq_local_tail = 0;
+    ring->to_submit = 0;
+
+    /* Both rings share one mapping on every kernel with IORING_FEAT_SINGLE_MMAP, we map them separately to work on all */
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    char* sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    char* cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED){
+        perror("ERROR: Mapping io_uring failed");
+        return -1;
+    }
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+    return 0;
+}
+
+/* Queue a read or write of buffer index on fd, it is submitted with the next uring_enter */
+void uring_queue(struct uring* ring, int fd, int direction, int fixed, struct iovec* buffer, int index){
+    unsigned slot = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    if (fixed) sqe->opcode = direction == READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    else sqe->opcode = direction == READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->off = -1;          /* pipes have no offset, use the current position */
+    sqe->addr = (unsigned long)buffer->iov_base;
+    sqe->len = buffer->iov_len;
+    sqe->buf_index = fixed ? index : 0;
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+}
+
+/* Submit everything queued and wait for at least one completion.
+ * Entries the kernel did not take on a short submit or EINTR stay published and go with the next call. */
+int uring_enter(struct uring* ring){
+    atomic_store_explicit((_Atomic unsigned*)ring->sq_tail, ring->sq_local_tail, memory_order_release);
+    int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (submitted == -1){
+        if (errno == EINTR) return 0;
+        perror("ERROR: io_uring_enter failed");
+        return -1;
+    }
+    ring->to_submit -= submitted;
+    return 0;
+}
+
+// Read or write size byte blocks through fd endlessly, with uring_depth of them in flight.
+int uring_transfer(int fd, int direction, size_t size){
+    if (size > (1U << 30)) size = 1U << 30;     /* one operation is at most an unsigned int long */
+    struct uring ring;
+    if (uring_setup(&ring, uring_depth) != 0) return -1;
+
+    struct iovec* buffers = malloc(sizeof(struct iovec) * uring_depth);
+    char* dummy_data = generate_data(size);
+    for (int i = 0; i < uring_depth; i++){
+        buffers[i].iov_base = allocate_buffer(size);
+        if (buffers[i].iov_base == NULL){
+            perror("ERROR: Allocating io_uring buffers failed");
+            return -1;
+        }
+        buffers[i].iov_len = size;
+        if (direction == WRITE) memcpy(buffers[i].iov_base, dummy_data, size);
+    }
+    release_buffer(dummy_data, size);
+    /* Registering pins the pages, which RLIMIT_MEMLOCK may not allow for large blocks */
+    int fixed = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, buffers, uring_depth) == 0;
+    if (!fixed && direction == READ){
+        perror("Registering io_uring buffers failed, using unregistered buffers");
+    }
+    if (direction == READ){
+        printf("io_uring depth: %d, %s buffers\n", uring_depth, fixed ? "registered" : "unregistered");
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < uring_depth; i++){
+        uring_queue(&ring, fd, direction, fixed, &buffers[i], i);
+    }
+    while (1){
+        if (uring_enter(&ring) != 0) return -1;
+        unsigned head = *ring.cq_head;
+        unsigned tail = atomic_load_explicit((_Atomic unsigned*)ring.cq_tail, memory_order_acquire);
+        for (; head != tail; head++){
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            int index = cqe->user_data;
+            if (cqe->res < 0){
+                errno = -cqe->res;
+                perror(direction == READ ? "ERROR: read failed" : "ERROR: write failed");
+                return -1;
+            }
+            if (cqe->res == 0 && direction == READ){   /* the writer is gone */
+                return 1;
+            }
+            if (direction == READ) count_bytes_read(cqe->res);
+            uring_queue(&ring, fd, direction, fixed, &buffers[index], index);
+        }
+        atomic_store_explicit((_Atomic unsigned*)ring.cq_head, head, memory_order_release);
+    }
+    return 1;
+}
+
+/* Shared memory ring buffer
+ * A single producer/single consumer ring in a memfd mapping shared by the forked writer and reader.
+ * head is only written by the writer and tail only by the reader, each on its own cache line,
+ * so the two sides never write to the same line. Both are byte counts that only grow,
+ * the position in the ring is the count modulo the capacity.
+ * A side only sleeps (in read on an eventfd) when the ring is empty or full, and the other side
+ * only signals when it sees the sleeper's waiting flag, so the steady state has no syscalls at all.
+ */
+#define CACHE_LINE 64
+#define RING_CAPACITY (1024 * 1024)
+
+struct ring {
+    _Alignas(CACHE_LINE) _Atomic size_t head;           /* bytes written so far, by the writer */
+    _Alignas(CACHE_LINE) _Atomic size_t tail;           /* bytes read so far, by the reader */
+    _Alignas(CACHE_LINE) _Atomic int reader_waiting;    /* reader sleeps until data arrives */
+    _Alignas(CACHE_LINE) _Atomic int writer_waiting;    /* writer sleeps until there is space */
+    _Alignas(CACHE_LINE) char data[RING_CAPACITY];
+};
+
+/* Sleep on an eventfd until the other side signals it */
+void ring_sleep(int event){
+    uint64_t count;
+    while (read(event, &count, sizeof(count)) == -1 && errno == EINTR);
+}
+
+/* Wake the other side if it is sleeping.
+ * The fence orders the caller's release store of head or tail before the load of the waiting flag;
+ * without it the load could be satisfied first and miss a sleeper that has just checked the ring. */
+void ring_wake(_Atomic int* waiting, int event){
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(waiting) && atomic_exchange(waiting, 0)){
+        uint64_t one = 1;
+        write(event, &one, sizeof(one));
+    }
+}
+
+/* Copy size bytes into the ring, waiting for space when it is full */
+void ring_write(struct ring* ring, int space_event, int data_event, const char* data, size_t size){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (size > 0){
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        size_t space = RING_CAPACITY - (head - tail);
+        if (space == 0){
+            /* Announce that we are going to sleep, then check again so a wakeup is never missed */
+            atomic_store(&ring->writer_waiting, 1);
+            if (RING_CAPACITY - (head - atomic_load(&ring->tail)) == 0){
+                ring_sleep(space_event);
+            } else {
+                atomic_store(&ring->writer_waiting, 0);
+            }
+            continue;
+        }
+        size_t chunk = size < space ? size : space;
+        size_t position = head % RING_CAPACITY;
+        size_t first = chunk < RING_CAPACITY - position ? chunk : RING_CAPACITY - position;
+        memcpy(ring->data + position, data, first);
+        memcpy(ring->data, data + first, chunk - first);    /* wrap around */
+        head += chunk;
+        data += chunk;
+        size -= chunk;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        ring_wake(&ring->reader_waiting, data_event);
+    }
+}
+
+/* Copy up to size bytes out of the ring, waiting for data when it is empty. Returns bytes read. */
+size_t ring_read(struct ring* ring, int space_event, int data_event, char* buff, size_t size){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (1){
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t available = head - tail;
+        if (available == 0){
+            atomic_store(&ring->reader_waiting, 1);
+            if (atomic_load(&ring->head) == tail){
+                ring_sleep(data_event);
+            } else {
+                atomic_store(&ring->reader_waiting, 0);
+            }
+            continue;
+        }
+        size_t chunk = size < available ? size : available;
+        size_t position = tail % RING_CAPACITY;
+        size_t first = chunk < RING_CAPACITY - position ? chunk : RING_CAPACITY - position;
+        memcpy(buff, ring->data + position, first);
+        memcpy(buff + first, ring->data, chunk - first);    /* wrap around */
+        atomic_store_explicit(&ring->tail, tail + chunk, memory_order_release);
+        ring_wake(&ring->writer_waiting, space_event);
+        return chunk;
+    }
+}
+
+// Establish a shared memory ring and read/write as fast as possible through it.
+int shared_memory_ring(size_t size){
+    /* Print the parent process pid, to use in task C */
+    printf("================================\n");
+    printf("SHARED MEMORY RING\n");
+    printf("================================\n");
+    printf("Parent process PID: %i\n",getpid());
+    printf("================================\n");
+
+    /* Create the shared mapping and the two wakeup eventfds before forking, so both sides get them */
+    int memory = memfd_create("ipc_ring", 0);
+    if (memory == -1 || ftruncate(memory, sizeof(struct ring)) == -1){
+        perror("ERROR: Creating shared memory failed. \n");
+        return -1;
+    }
+    struct ring* ring = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+    close(memory);
+    if (ring == MAP_FAILED){
+        perror("ERROR: Mapping shared memory failed. \n");
+        return -1;
+    }
+    int data_event = eventfd(0, 0);     /* signalled by the writer when the reader waits for data */
+    int space_event = eventfd(0, 0);    /* signalled by the reader when the writer waits for space */
+    if (data_event == -1 || space_event == -1){
+        perror("ERROR: Creating eventfd failed. \n");
+        return -1;
+    }
+
+    int res = fork ();
+    if (res > 0) {                      /* parent process (Supposed to read)*/
+        pin_side(READ);
+        char *buff = allocate_buffer(size);
+        while(1){
+            size_t r = ring_read(ring, space_event, data_event, buff, size);
+            count_bytes_read(r);
+        }
+        release_buffer(buff, size); // Free the trash!
+    }
+    else if (res == 0) {        /* child process (Supposed to write endlessly)*/
+        pin_side(WRITE);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);  /* no pipe to break, so stop writing when the reader dies */
+        char* dummy_data = generate_data(size);
+        while(1){
+            ring_write(ring, space_event, data_event, dummy_data, size);
+        }
+        release_buffer(dummy_data, size);
+    }
+    else {                      /* if the forking failed*/
+        perror("ERROR: Fork failed. \n");
+        // Kill the faulty process, with exit signal EXIT_FAILURE
+        exit(EXIT_FAILURE);
+        return -1;
+    }
+    munmap(ring, sizeof(struct ring));
+    return 1;
+}
+// Establish unnamed pipe and move data through it without copying.
+// The writer gifts its pages to the pipe with vmsplice, and the reader splices them on to the sink
+// (/dev/null unless a file is given), so the data never passes through a user space buffer.
+int spliced_pipe(size_t size, const char* sink){
+    printf("================================\n");
+    printf("UNNAMED PIPE (vmsplice/splice)\n");
+    printf("================================\n");
+    printf("Parent process PID: %i\n",getpid());
+    printf("================================\n");
+    int res, fd[2]; /* child PID and descriptor */
+    if (pipe (fd) != 0) {
+        perror("ERROR: Creating pipe failed. \n");
+        return -1;
+    }
+    printf("Pipe capacity: %i\n", set_pipe_capacity(fd[READ]));
+    res = fork ();
+    if (res > 0) {                      /* parent process (Supposed to read)*/
+        pin_side(READ);
+        close (fd[WRITE]);              /* close writing side */
+        int filedes = open(sink, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (filedes == -1){
+            perror("ERROR: file open failed");
+            return -1;
+        }
+        ssize_t r = 0;
+        while(r != -1){
+            r = splice(fd[READ], NULL, filedes, NULL, size, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (r == -1){
+                perror("ERROR: splice failed");
+                return -1;
+            }
+            count_bytes_read(r);
+        }
+        close (filedes);
+        close (fd[READ]);
+    }
+    else if (res == 0) {        /* child process (Supposed to write endlessly)*/
+        pin_side(WRITE);
+        close (fd[READ]);       /* close reading side */
+        /* Gifted pages have to be page aligned, and are never written again after the gift */
+        long page_size = sysconf(_SC_PAGESIZE);
+        char *dummy_data;
+        if (posix_memalign((void**)&dummy_data, page_size, size) != 0){
+            perror("ERROR: allocating aligned data failed");
+            return -1;
+        }
+        memset(dummy_data, 'a', size);  // Arbritary data
+        while(1){
+            struct iovec io = { .iov_base = dummy_data, .iov_len = size };
+            while (io.iov_len > 0){     /* vmsplice stops when the pipe is full, so keep going */
+                ssize_t w = vmsplice(fd[WRITE], &io, 1, SPLICE_F_GIFT);
+                if (w == -1){
+                    perror("ERROR: vmsplice failed");
+                    return -1;
+                }
+                io.iov_base = (char*)io.iov_base + w;
+                io.iov_len -= w;
+            }
+        }
+        close (fd[WRITE]);      /* release the descriptor */
+        free(dummy_data);
+    }
+    else {                      /* if the forking failed*/
+        perror("ERROR: Fork failed. \n");
+        // Kill the faulty process, with exit signal EXIT_FAILURE
+        exit(EXIT_FAILURE);
+        return -1;
+    }
+    return 1;
+}
+/* Read from a connected descriptor forever, counting the bandwidth */
+int read_endlessly(int filedes, size_t size){
+    char *buff = allocate_buffer(size);
+    ssize_t r = 0;
+    while(r != -1){
+        r = read(filedes, buff, size);          /* Listen to the socket */
+        if (r == -1){
+            perror("ERROR: read failed");
+            release_buffer(buff, size);
+            return -1;
+        }
+        count_bytes_read(r);
+        /* we never use the buff, and overwrite it all the time, as it is filled with trash */
+    }
+    release_buffer(buff, size); // Free the trash!
+    return 1;
+}
+
+/* Write blocks of size bytes to a connected descriptor forever.
+ * A SOCK_SEQPACKET message has to fit in the socket buffer, so blocks too big for one
+ * message are sent as several messages of the largest size the socket accepts. */
+int write_endlessly(int filedes, size_t size){
+    char* dummy_data = generate_data(size);
+    size_t message_size = size;
+    while(1){
+        size_t sent = 0;
+        while (sent < size){
+            size_t chunk = size - sent < message_size ? size - sent : message_size;
+            ssize_t w = write(filedes, dummy_data + sent, chunk);
+            if (w == -1 && errno == EMSGSIZE && message_size > 1){
+                message_size /= 2;
+                continue;
+            }
+            if (w == -1){
+                perror("ERROR: write failed");
+                release_buffer(dummy_data, size);
+                return -1;
+            }
+            sent += w;
+        }
+    }
+    release_buffer(dummy_data, size);
+    return 1;
+}
+
+// Establish a connected socket pair (SOCK_STREAM or SOCK_SEQPACKET) and read/write as fast as possible through it.
+int socket_pair(size_t size, int type){
+    printf("================================\n");
+    printf("SOCKETPAIR (%s)\n", type == SOCK_STREAM ? "SOCK_STREAM" : "SOCK_SEQPACKET");
+    printf("================================\n");
+    printf("Parent process PID: %i\n",getpid());
+    printf("================================\n");
+    int res, fd[2]; /* child PID and descriptors, both ends can read and write */
+    if (socketpair(AF_UNIX, type, 0, fd) != 0) {
+        perror("ERROR: Creating socket pair failed. \n");
+        return -1;
+    }
+    res = fork ();
+    if (res > 0) {                      /* parent process (Supposed to read)*/
+        pin_side(READ);
+        close (fd[WRITE]);
+        int status = read_endlessly(fd[READ], size);
+        close (fd[READ]);
+        return status;
+    }
+    else if (res == 0) {        /* child process (Supposed to write endlessly)*/
+        pin_side(WRITE);
+        close (fd[READ]);
+        int status = write_endlessly(fd[WRITE], size);
+        close (fd[WRITE]);
+        return status;
+    }
+    perror("ERROR: Fork failed. \n");
+    // Kill the faulty process, with exit signal EXIT_FAILURE
+    exit(EXIT_FAILURE);
+    return -1;
+}
+
+// Establish a Unix domain socket through a listener on the filesystem, and read/write as fast as possible through it.
+int unix_socket(size_t size){
+    printf("================================\n");
+    printf("UNIX DOMAIN SOCKET\n");
+    printf("================================\n");
+    printf("Parent process PID: %i\n",getpid());
+    printf("================================\n");
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    const char* socket_name = "/tmp/ipc_socket";
+    strcpy(address.sun_path, socket_name);
+    remove(socket_name); // Remove the file, free up for a socket
+
+    /* Listen before forking, so the child can connect right away */
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1 ||
+        bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+        listen(listener, 1) == -1){
+        perror("ERROR: Creating socket failed. \n");
+        return -1;
+    }
+    int res = fork ();
+    if (res > 0) {                      /* parent process (Supposed to read)*/
+        pin_side(READ);
+        int filedes = accept(listener, NULL, NULL);
+        close (listener);
+        if (filedes == -1){
+            perror("ERROR: accept failed");
+            return -1;
+        }
+        int status = read_endlessly(filedes, size);
+        close (filedes);
+        return status;
+    }
+    else if (res == 0) {        /* child process (Supposed to write endlessly)*/
+        pin_side(WRITE);
+        close (listener);
+        int filedes = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (filedes == -1 || connect(filedes, (struct sockaddr*)&address, sizeof(address)) == -1){
+            perror("ERROR: connect failed");
+            return -1;
+        }
+        int status = write_endlessly(filedes, size);
+        close (filedes);
+        return status;
+    }
+    perror("ERROR: Fork failed. \n");
+    // Kill the faulty process, with exit signal EXIT_FAILURE
+    exit(EXIT_FAILURE);
+    return -1;
+}
+/* Performance counters
+ * Counted with perf_event_open over a whole run, the reader, the writer and whatever threads
+ * and children they start (inherit), kernel work included. The hardware events are missing in
+ * most VMs and containers, those runs get the software events only. Without permission to count
+ * the kernel (perf_event_paranoid), user space is counted instead.
+ */
+#define PERF_EVENTS 5
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+} perf_events[PERF_EVENTS] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context_switches" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu_migrations" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page_faults" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+};
+
+/* Open every event on pid and its future children. Events that are not available get -1. */
+int perf_open(pid_t pid, int* fds){
+    static int warned = 0;
+    int opened = 0;
+    for (int i = 0; i < PERF_EVENTS; i++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.inherit = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(__NR_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fds[i] == -1 && errno == EACCES){
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = syscall(__NR_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+        if (fds[i] == -1 && !warned){
+            fprintf(stderr, "perf_event_open %s: %s, reporting without it\n", perf_events[i].name, strerror(errno));
+        }
+        if (fds[i] != -1) opened++;
+    }
+    warned = 1;
+    return opened;
+}
+
+/* Read the counts, scaled up when the PMU had to multiplex them. Missing events read as -1. */
+void perf_read(int* fds, double* values){
+    for (int i = 0; i < PERF_EVENTS; i++){
+        uint64_t data[3];   /* value, time enabled, time running */
+        values[i] = -1;
+        if (fds[i] != -1 && read(fds[i], data, sizeof(data)) == sizeof(data)){
+            values[i] = data[2] > 0 ? (double)data[0] * data[1] / data[2] : 0;
+        }
+    }
+}
+
+void perf_close(int* fds){
+    for (int i = 0; i < PERF_EVENTS; i++){
+        if (fds[i] != -1) close(fds[i]);
+    }
+}
+
+/* Sweep mode
+ * Replaces collecting the Task B/D tables by hand. Every transport is run over a range of
+ * block sizes, each point several times for a fixed duration after a warm-up. The bandwidth
+ * is sampled at a fixed interval, and mean, standard deviation and percentiles over all
+ * samples of a point are printed as CSV or JSON. The process exits when the sweep is done.
+ *
+ * Each run is a child in its own process group, running the transport exactly like the normal mode.
+ * The reader counts into shared_bytes_read, which we sample from here, and the whole group is
+ * killed at the end of the run.
+ *
+ * The pipe based transports (unnamed, named, uring, uring-named and splice) are also swept over pipe capacities,
+ * the others ignore the capacity list.
+ */
+#define SWEEP_TRANSPORTS "unnamed,named,uring,uring-named,shm,splice,stream,seqpacket,unix"
+
+struct sweep_options {
+    char* transports;       /* comma separated */
+    size_t min_size;
+    size_t max_size;
+    double factor;          /* next size = size * factor */
+    double warmup;          /* seconds before sampling starts */
+    double duration;        /* seconds of sampling per repetition */
+    double interval;        /* seconds per sample */
+    int repetitions;
+    int json;
+    int perf;               /* count perf events per run */
+    char* capacities;       /* comma separated pipe capacities, 0 is the kernel default */
+    char* placements;       /* comma separated, see choose_placement */
+};
+
+double now_seconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void sleep_seconds(double seconds){
+    struct timespec duration = { .tv_sec = (time_t)seconds, .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9) };
+    while (nanosleep(&duration, &duration) == -1 && errno == EINTR);
+}
+
+int compare_doubles(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Value at the given percentile of sorted samples, nearest rank */
+double percentile(double* sorted, int count, double p){
+    int rank = (int)ceil(p / 100.0 * count) - 1;
+    if (rank < 0) rank = 0;
+    if (rank >= count) rank = count - 1;
+    return sorted[rank];
+}
+
+/* Run one transport at one block size, appending bandwidth samples (bytes/s). Returns samples added.
+ * With options->perf, the events counted while sampling are added to perf_totals and the bytes
+ * read meanwhile to perf_bytes. */
+int sweep_run(const char* transport, size_t size, struct sweep_options* options, double* samples,
+              double* perf_totals, double* perf_bytes){
+    *shared_bytes_read = 0;
+    int go[2];              /* the runner waits for the counters to be attached before starting */
+    if (pipe(go) != 0){
+        perror("ERROR: Creating pipe failed. \n");
+        return 0;
+    }
+    pid_t runner = fork();
+    if (runner < 0){
+        perror("ERROR: Fork failed. \n");
+        return 0;
+    }
+    if (runner == 0){
+        setpgid(0, 0);      /* so the reader and writer can be killed together */
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 1);   /* keep the transport banners out of the results */
+        close(devnull);
+        close(go[WRITE]);
+        char ready;
+        if (read(go[READ], &ready, 1) != 1) exit(EXIT_FAILURE);
+        close(go[READ]);
+        run_transport(transport, size, "/dev/null");
+        exit(EXIT_FAILURE);
+    }
+    setpgid(runner, runner);
+    close(go[READ]);
+    int perf_fds[PERF_EVENTS];
+    if (options->perf) perf_open(runner, perf_fds);
+    if (write(go[WRITE], "", 1) != 1) perror("ERROR: write failed");
+    close(go[WRITE]);
+
+    sleep_seconds(options->warmup);
+    int count = 0;
+    double perf_start[PERF_EVENTS], perf_end[PERF_EVENTS];
+    if (options->perf) perf_read(perf_fds, perf_start);
+    double start = now_seconds();
+    double previous_time = start;
+    unsigned long long previous_bytes = atomic_load(shared_bytes_read);
+    unsigned long long start_bytes = previous_bytes;
+    while (previous_time - start < options->duration){
+        sleep_seconds(options->interval);
+        double time = now_seconds();
+        unsigned long long bytes = atomic_load(shared_bytes_read);
+        samples[count++] = (bytes - previous_bytes) / (time - previous_time);
+        previous_time = time;
+        previous_bytes = bytes;
+    }
+    if (options->perf){
+        perf_read(perf_fds, perf_end);
+        for (int i = 0; i < PERF_EVENTS; i++){
+            /* once an event is missing for a run, it stays missing for the point */
+            if (perf_start[i] < 0 || perf_totals[i] < 0) perf_totals[i] = -1;
+            else perf_totals[i] += perf_end[i] - perf_start[i];
+        }
+        *perf_bytes += previous_bytes - start_bytes;
+        perf_close(perf_fds);
+    }
+
+    kill(-runner, SIGKILL);
+    waitpid(runner, NULL, 0);
+    return count;
+}
+
+/* Measure one transport at one block size and print its row.
+ * first_row is cleared once a row is printed, the JSON rows after it get a separating comma. */
+void sweep_point(const char* transport, double size, struct sweep_options* options,
+                 double* samples, int uses_pipe, int effective_capacity, int* first_row){
+    int count = 0;
+    double perf_totals[PERF_EVENTS] = {0};
+    double perf_bytes = 0;
+    for (int repetition = 0; repetition < options->repetitions; repetition++){
+        count += sweep_run(transport, (size_t)size, options, samples + count, perf_totals, &perf_bytes);
+    }
+    if (count == 0) return;
+
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += samples[i];
+    double mean = sum / count;
+    double squares = 0;
+    for (int i = 0; i < count; i++) squares += (samples[i] - mean) * (samples[i] - mean);
+    double stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    char capacity_field[32] = "";   /* empty for transports without a pipe */
+    if (uses_pipe) snprintf(capacity_field, sizeof(capacity_field), "%d", effective_capacity);
+    if (options->json){
+        printf("%s  {\"transport\": \"%s\", \"placement\": \"%s\", \"reader_cpu\": %d, \"writer_cpu\": %d, \"pipe_capacity\": %s, \"buffers\": \"%s\", \"block_size\": %zu, \"repetitions\": %d, \"samples\": %d, "
+            "\"mean_bps\": %.0f, \"stddev_bps\": %.0f, \"min_bps\": %.0f, \"p50_bps\": %.0f, "
+            "\"p90_bps\": %.0f, \"p99_bps\": %.0f, \"max_bps\": %.0f",
+            *first_row ? "" : ",\n", transport, placement, reader_cpu, writer_cpu, uses_pipe ? capacity_field : "null", buffer_kind, (size_t)size, options->repetitions, count,
+            mean, stddev, samples[0], percentile(samples, count, 50),
+            percentile(samples, count, 90), percentile(samples, count, 99), samples[count - 1]);
+    } else {
+        printf("%s,%s,%d,%d,%s,%s,%zu,%d,%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f",
+            transport, placement, reader_cpu, writer_cpu, capacity_field, buffer_kind, (size_t)size, options->repetitions, count,
+            mean, stddev, samples[0], percentile(samples, count, 50),
+            percentile(samples, count, 90), percentile(samples, count, 99), samples[count - 1]);
+    }
+    /* Events per GB read, empty (null) where the event could not be counted */
+    for (int i = 0; options->perf && i < PERF_EVENTS; i++){
+        int counted = perf_totals[i] >= 0 && perf_bytes > 0;
+        double per_gb = counted ? perf_totals[i] / (perf_bytes / 1e9) : 0;
+        if (options->json){
+            if (counted) printf(", \"%s_per_gb\": %.1f", perf_events[i].name, per_gb);
+            else printf(", \"%s_per_gb\": null", perf_events[i].name);
+        } else {
+            if (counted) printf(",%.1f", per_gb);
+            else printf(",");
+        }
+    }
+    printf(options->json ? "}" : "\n");
+    *first_row = 0;
+    fflush(stdout);
+}
+
+void sweep_usage(){
+    printf("Usage: main --sweep [options]\n");
+    printf("  -t, --transports LIST  comma separated, default " SWEEP_TRANSPORTS "\n");
+    printf("                         thread-unnamed, thread-named, thread-shm, thread-stream, thread-seqpacket,\n");
+    printf("                         thread-unix and queue run the reader and writer as threads instead\n");
+    printf("  -m, --min SIZE         smallest block size, default 1\n");
+    printf("  -M, --max SIZE         largest block size, default 10000000\n");
+    printf("  -x, --factor F         block size multiplier between points, default 10\n");
+    printf("  -w, --warmup SECONDS   warm-up before sampling, default 0.5\n");
+    printf("  -d, --duration SECONDS sampling time per repetition, default 2\n");
+    printf("  -i, --interval SECONDS time per sample, default 0.1\n");
+    printf("  -r, --repetitions N    repetitions per point, default 3\n");
+    printf("  -j, --json             print JSON instead of CSV\n");
+    printf("  -c, --capacities LIST  comma separated pipe capacities in bytes, 0 is the default, default 0\n");
+    printf("  -p, --placements LIST  comma separated none,same-core,smt,same-socket,cross-socket, default none\n");
+    printf("  -q, --depth N          operations in flight for the uring transports, default 8\n");
+    printf("  -B, --buffers KIND     malloc, page, thp or hugetlb transfer buffers, default malloc\n");
+    printf("  -P, --perf             add perf event counts per GB transferred\n");
+}
+
+int sweep(int argc, char *argv[]){
+    struct sweep_options options = {
+        .transports = SWEEP_TRANSPORTS,
+        .min_size = 1, .max_size = 10000000, .factor = 10,
+        .warmup = 0.5, .duration = 2, .interval = 0.1,
+        .repetitions = 3, .json = 0, .capacities = "0",
+        .placements = "none",
+    };
+    static struct option long_options[] = {
+        {"transports", required_argument, 0, 't'},
+        {"min", required_argument, 0, 'm'},
+        {"max", required_argument, 0, 'M'},
+        {"factor", required_argument, 0, 'x'},
+        {"warmup", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 'd'},
+        {"interval", required_argument, 0, 'i'},
+        {"repetitions", required_argument, 0, 'r'},
+        {"json", no_argument, 0, 'j'},
+        {"capacities", required_argument, 0, 'c'},
+        {"placements", required_argument, 0, 'p'},
+        {"depth", required_argument, 0, 'q'},
+        {"buffers", required_argument, 0, 'B'},
+        {"perf", no_argument, 0, 'P'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "t:m:M:x:w:d:i:r:jc:p:q:B:Ph", long_options, NULL)) != -1){
+        switch (option){
+            case 't': options.transports = optarg; break;
+            case 'm': options.min_size = strtoull(optarg, NULL, 10); break;
+            case 'M': options.max_size = strtoull(optarg, NULL, 10); break;
+            case 'x': options.factor = atof(optarg); break;
+            case 'w': options.warmup = atof(optarg); break;
+            case 'd': options.duration = atof(optarg); break;
+            case 'i': options.interval = atof(optarg); break;
+            case 'r': options.repetitions = atoi(optarg); break;
+            case 'j': options.json = 1; break;
+            case 'c': options.capacities = optarg; break;
+            case 'p': options.placements = optarg; break;
+            case 'q': uring_queue_depth = atoi(optarg); break;
+            case 'B': buffer_kind = optarg; break;
+            case 'P': options.perf = 1; break;
+            default: sweep_usage(); return option == 'h' ? 0 : 1;
+        }
+    }
+    if (options.min_size < 1 || options.factor <= 1 || options.interval <= 0 ||
+        options.duration < options.interval || options.repetitions < 1 ||
+        uring_queue_depth < 1 || uring_queue_depth > 4096 || !valid_buffer_kind(buffer_kind)){
+        sweep_usage();
+        return 1;
+    }
+
+    /* The counter the runs report into, shared with every child */
+    shared_bytes_read = mmap(NULL, sizeof(*shared_bytes_read), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared_bytes_read == MAP_FAILED){
+        perror("ERROR: Mapping shared memory failed. \n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);   /* writers see EPIPE instead, when their reader is killed first */
+
+    int max_samples = options.repetitions * ((int)(options.duration / options.interval) + 2);
+    double* samples = malloc(sizeof(double) * max_samples);
+    int first_row = 1;
+    if (options.json) printf("[\n");
+    else {
+        printf("transport,placement,reader_cpu,writer_cpu,pipe_capacity,buffers,block_size,repetitions,samples,mean_bps,stddev_bps,min_bps,p50_bps,p90_bps,p99_bps,max_bps");
+        for (int i = 0; options.perf && i < PERF_EVENTS; i++) printf(",%s_per_gb", perf_events[i].name);
+        printf("\n");
+    }
+    fflush(stdout);
+
+    char* placements = strdup(options.placements);
+    char* placement_save;
+    for (char* placement_name = strtok_r(placements, ",", &placement_save); placement_name != NULL; placement_name = strtok_r(NULL, ",", &placement_save)){
+        if (choose_placement(placement_name) != 0) continue;
+        char* transports = strdup(options.transports);
+        char* transport_save;
+        for (char* transport = strtok_r(transports, ",", &transport_save); transport != NULL; transport = strtok_r(NULL, ",", &transport_save)){
+            int uses_pipe = strcmp(transport, "unnamed") == 0 || strcmp(transport, "named") == 0 || strcmp(transport, "splice") == 0 ||
+                            strcmp(transport, "uring") == 0 || strcmp(transport, "uring-named") == 0 ||
+                            strcmp(transport, "thread-unnamed") == 0 || strcmp(transport, "thread-named") == 0;
+            char* capacities = strdup(uses_pipe ? options.capacities : "0");
+            char* capacity_save;
+            for (char* capacity = strtok_r(capacities, ",", &capacity_save); capacity != NULL; capacity = strtok_r(NULL, ",", &capacity_save)){
+                pipe_capacity = strtoull(capacity, NULL, 10);
+                /* What the kernel actually gives us, after the limit and rounding */
+                int effective_capacity = 0;
+                int probe[2];
+                if (uses_pipe && pipe(probe) == 0){
+                    effective_capacity = set_pipe_capacity(probe[READ]);
+                    close(probe[READ]);
+                    close(probe[WRITE]);
+                }
+                for (double size = options.min_size; size <= options.max_size; size *= options.factor){
+                    sweep_point(transport, size, &options, samples, uses_pipe, effective_capacity, &first_row);
+                }
+            }
+            free(capacities);
+        }
+        free(transports);
+    }
+    if (options.json) printf("\n]\n");
+
+    free(placements);
+    free(samples);
+    munmap(shared_bytes_read, sizeof(*shared_bytes_read));
+    return 0;
+}
+/* Latency histogram
+ * HDR-style log-linear buckets: values below 2^HISTOGRAM_SUB_BITS get a bucket each, and every
+ * power of two above that is split into 2^HISTOGRAM_SUB_BITS equal buckets. Recording is a few
+ * instructions, and every value is known to within 1/64 (~1.6%) of itself.
+ */
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+};
+
+int histogram_index(uint64_t value){
+    if (value < HISTOGRAM_SUB_COUNT) return value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_COUNT + (int)((value >> shift) - HISTOGRAM_SUB_COUNT);
+}
+
+/* Smallest value that falls in the bucket */
+uint64_t histogram_value(int index){
+    int block = index / HISTOGRAM_SUB_COUNT;
+    if (block == 0) return index;
+    uint64_t sub = (index % HISTOGRAM_SUB_COUNT) + HISTOGRAM_SUB_COUNT;
+    return sub << (block - 1);
+}
+
+void histogram_record(struct histogram* histogram, uint64_t value){
+    histogram->counts[histogram_index(value)]++;
+    if (histogram->total == 0 || value < histogram->min) histogram->min = value;
+    if (value > histogram->max) histogram->max = value;
+    histogram->sum += value;
+    histogram->total++;
+}
+
+/* Value at the given percentile */
+uint64_t histogram_percentile(struct histogram* histogram, double p){
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * histogram->total);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++){
+        seen += histogram->counts[i];
+        if (seen >= rank){
+            uint64_t value = histogram_value(i);
+            return value > histogram->max ? histogram->max : value;
+        }
+    }
+    return histogram->max;
+}
+
+/* Ping-pong mode
+ * Measures round-trip latency instead of bandwidth. The parent sends a message, the child sends
+ * it straight back, and every round trip is timed with clock_gettime into a histogram.
+ */
+uint64_t now_nanoseconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* One side of a two-way channel: descriptors to read and write, or a pair of shared memory rings */
+struct endpoint {
+    int read_fd;
+    int write_fd;
+    struct ring* read_ring;
+    struct ring* write_ring;
+    int read_space_event, read_data_event;      /* wakeups for read_ring */
+    int write_space_event, write_data_event;    /* wakeups for write_ring */
+};
+
+int endpoint_send(struct endpoint* end, const char* data, size_t size){
+    if (end->write_ring != NULL){
+        ring_write(end->write_ring, end->write_space_event, end->write_data_event, data, size);
+        return 0;
+    }
+    while (size > 0){
+        ssize_t w = write(end->write_fd, data, size);
+        if (w == -1){
+            perror("ERROR: write failed");
+            return -1;
+        }
+        data += w;
+        size -= w;
+    }
+    return 0;
+}
+
+int endpoint_receive(struct endpoint* end, char* buff, size_t size){
+    while (size > 0){
+        ssize_t r;
+        if (end->read_ring != NULL){
+            r = ring_read(end->read_ring, end->read_space_event, end->read_data_event, buff, size);
+        } else {
+            r = read(end->read_fd, buff, size);
+        }
+        if (r <= 0){
+            if (r == -1) perror("ERROR: read failed");
+            return -1;
+        }
+        buff += r;
+        size -= r;
+    }
+    return 0;
+}
+
+/* Map a ring and its two eventfds, shared with children forked afterwards */
+struct ring* ring_create(int* space_event, int* data_event){
+    struct ring* ring = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    *space_event = eventfd(0, 0);
+    *data_event = eventfd(0, 0);
+    if (ring == MAP_FAILED || *space_event == -1 || *data_event == -1){
+        perror("ERROR: Creating shared memory ring failed. \n");
+        return NULL;
+    }
+    return ring;
+}
+
+/* Run round_trips timed round trips (after warmup untimed ones) of size bytes over a transport */
+int pingpong_run(const char* transport, size_t size, long warmup, long round_trips, struct histogram* histogram){
+    struct endpoint parent = {.read_fd = -1, .write_fd = -1}, child = {.read_fd = -1, .write_fd = -1};
+    const char* ping_name = "/tmp/fifo_ping";
+    const char* pong_name = "/tmp/fifo_pong";
+    const char* socket_name = "/tmp/ipc_socket";
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    int listener = -1;
+
+    /* Everything that has to exist in both processes is created before forking */
+    if (strcmp(transport, "unnamed") == 0){
+        int ping[2], pong[2];
+        if (pipe(ping) != 0 || pipe(pong) != 0){
+            perror("ERROR: Creating pipe failed. \n");
+            return -1;
+        }
+        parent.write_fd = ping[WRITE]; parent.read_fd = pong[READ];
+        child.read_fd = ping[READ];    child.write_fd = pong[WRITE];
+    } else if (strcmp(transport, "named") == 0){
+        remove(ping_name);
+        remove(pong_name);
+        if (mkfifo(ping_name, 0666) != 0 || mkfifo(pong_name, 0666) != 0){
+            perror("ERROR: Creating pipe-file failed. \n");
+            return -1;
+        }
+    } else if (strcmp(transport, "stream") == 0 || strcmp(transport, "seqpacket") == 0){
+        int fd[2];
+        if (socketpair(AF_UNIX, strcmp(transport, "stream") == 0 ? SOCK_STREAM : SOCK_SEQPACKET, 0, fd) != 0){
+            perror("ERROR: Creating socket pair failed. \n");
+            return -1;
+        }
+        parent.read_fd = parent.write_fd = fd[0];
+        child.read_fd = child.write_fd = fd[1];
+    } else if (strcmp(transport, "unix") == 0){
+        strcpy(address.sun_path, socket_name);
+        remove(socket_name);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == -1 ||
+            bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+            listen(listener, 1) == -1){
+            perror("ERROR: Creating socket failed. \n");
+            return -1;
+        }
+    } else if (strcmp(transport, "shm") == 0){
+        parent.write_ring = child.read_ring = ring_create(&parent.write_space_event, &parent.write_data_event);
+        parent.read_ring = child.write_ring = ring_create(&parent.read_space_event, &parent.read_data_event);
+        if (parent.write_ring == NULL || parent.read_ring == NULL) return -1;
+        child.read_space_event = parent.write_space_event; child.read_data_event = parent.write_data_event;
+        child.write_space_event = parent.read_space_event; child.write_data_event = parent.read_data_event;
+    } else {
+        printf("Ping-pong is not supported over: %s\n", transport);
+        return -1;
+    }
+
+    char* buff = allocate_buffer(size);
+    char* dummy_data = generate_data(size);
+    int res = fork();
+    if (res == 0){              /* child process, sends every message straight back */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        pin_side(WRITE);
+        if (strcmp(transport, "named") == 0){
+            /* Open in the same order as the parent, or both would block */
+            child.read_fd = open(ping_name, O_RDONLY);
+            child.write_fd = open(pong_name, O_WRONLY);
+        } else if (strcmp(transport, "unix") == 0){
+            child.read_fd = child.write_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(child.read_fd, (struct sockaddr*)&address, sizeof(address)) == -1){
+                perror("ERROR: connect failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (long i = 0; i < warmup + round_trips; i++){
+            if (endpoint_receive(&child, buff, size) == -1 || endpoint_send(&child, buff, size) == -1){
+                exit(EXIT_FAILURE);
+            }
+        }
+        exit(EXIT_SUCCESS);
+    }
+    else if (res < 0){
+        perror("ERROR: Fork failed. \n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* parent process, times every round trip */
+    pin_side(READ);
+    if (strcmp(transport, "named") == 0){
+        parent.write_fd = open(ping_name, O_WRONLY);
+        parent.read_fd = open(pong_name, O_RDONLY);
+    } else if (strcmp(transport, "unix") == 0){
+        parent.read_fd = parent.write_fd = accept(listener, NULL, NULL);
+    }
+    int status = 0;
+    for (long i = 0; i < warmup + round_trips && status == 0; i++){
+        uint64_t start = now_nanoseconds();
+        status = endpoint_send(&parent, dummy_data, size);
+        if (status == 0) status = endpoint_receive(&parent, buff, size);
+        uint64_t elapsed = now_nanoseconds() - start;
+        if (i >= warmup) histogram_record(histogram, elapsed);
+    }
+    waitpid(res, NULL, 0);
+
+    /* Release everything, so the next transport starts clean */
+    if (strcmp(transport, "named") == 0){
+        unlink(ping_name);
+        unlink(pong_name);
+    } else if (strcmp(transport, "unix") == 0){
+        unlink(socket_name);
+    }
+    int fds[] = {parent.read_fd, parent.write_fd, child.read_fd, child.write_fd, listener,
+        parent.read_space_event, parent.read_data_event, parent.write_space_event, parent.write_data_event};
+    for (int i = 0; i < (int)(sizeof(fds) / sizeof(fds[0])); i++){
+        if (fds[i] > 0 && (i == 0 || fds[i] != fds[i - 1])) close(fds[i]);
+    }
+    if (parent.read_ring != NULL) munmap(parent.read_ring, sizeof(struct ring));
+    if (parent.write_ring != NULL) munmap(parent.write_ring, sizeof(struct ring));
+    release_buffer(buff, size);
+    release_buffer(dummy_data, size);
+    return status;
+}
+
+void pingpong_usage(){
+    printf("Usage: main --pingpong [options]\n");
+    printf("  -t, --transports LIST  comma separated, default unnamed,named,shm,stream,seqpacket,unix\n");
+    printf("  -s, --sizes LIST       comma separated message sizes in bytes, default 1\n");
+    printf("  -n, --round-trips N    timed round trips per size, default 100000\n");
+    printf("  -w, --warmup N         untimed round trips first, default 1000\n");
+    printf("  -p, --placement NAME   none, same-core, smt, same-socket or cross-socket, default none\n");
+}
+
+int pingpong(int argc, char *argv[]){
+    char* transports_option = "unnamed,named,shm,stream,seqpacket,unix";
+    char* sizes_option = "1";
+    long round_trips = 100000;
+    long warmup = 1000;
+    static struct option long_options[] = {
+        {"transports", required_argument, 0, 't'},
+        {"sizes", required_argument, 0, 's'},
+        {"round-trips", required_argument, 0, 'n'},
+        {"warmup", required_argument, 0, 'w'},
+        {"placement", required_argument, 0, 'p'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "t:s:n:w:p:h", long_options, NULL)) != -1){
+        switch (option){
+            case 't': transports_option = optarg; break;
+            case 's': sizes_option = optarg; break;
+            case 'n': round_trips = atol(optarg); break;
+            case 'w': warmup = atol(optarg); break;
+            case 'p': if (choose_placement(optarg) != 0) return 1; break;
+            default: pingpong_usage(); return option == 'h' ? 0 : 1;
+        }
+    }
+    if (round_trips < 1 || warmup < 0){
+        pingpong_usage();
+        return 1;
+    }
+
+    printf("transport,placement,reader_cpu,writer_cpu,message_size,round_trips,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,p99.9_ns,max_ns\n");
+    fflush(stdout);
+    struct histogram* histogram = malloc(sizeof(struct histogram));
+    char* transports = strdup(transports_option);
+    char* transport_save;
+    for (char* transport = strtok_r(transports, ",", &transport_save); transport != NULL; transport = strtok_r(NULL, ",", &transport_save)){
+        char* sizes = strdup(sizes_option);
+        char* size_save;
+        for (char* size = strtok_r(sizes, ",", &size_save); size != NULL; size = strtok_r(NULL, ",", &size_save)){
+            memset(histogram, 0, sizeof(struct histogram));
+            if (pingpong_run(transport, strtoull(size, NULL, 10), warmup, round_trips, histogram) != 0 || histogram->total == 0){
+                continue;
+            }
+            printf("%s,%s,%d,%d,%s,%llu,%llu,%.0f,%llu,%llu,%llu,%llu,%llu\n",
+                transport, placement, reader_cpu, writer_cpu, size, (unsigned long long)histogram->total,
+                (unsigned long long)histogram->min, histogram->sum / histogram->total,
+                (unsigned long long)histogram_percentile(histogram, 50),
+                (unsigned long long)histogram_percentile(histogram, 90),
+                (unsigned long long)histogram_percentile(histogram, 99),
+                (unsigned long long)histogram_percentile(histogram, 99.9),
+                (unsigned long long)histogram->max);
+            fflush(stdout);
+        }
+        free(sizes);
+    }
+    free(transports);
+    free(histogram);
+    return 0;
+}
+/* Scaling mode
+ * Forks N writers and M readers, either all on one shared pipe/FIFO or on N independent
+ * channels with a writer and a reader each, and measures how bandwidth holds up as they are
+ * added. Every process counts its own bytes in shared memory, so the controller can report
+ * each of them next to the aggregate.
+ */
+#define SCALE_MAX_PROCESSES 256
+
+struct scale_options {
+    char* writers;          /* comma separated writer counts */
+    char* readers;          /* comma separated reader counts, ignored for independent channels */
+    const char* transport;  /* unnamed or named */
+    int independent;        /* one channel per writer instead of one shared channel */
+    size_t size;
+    double warmup;
+    double duration;
+};
+
+/* Write or read size byte blocks forever, counting the bytes in *counter */
+void scale_worker(int fd, int direction, size_t size, _Atomic unsigned long long* counter){
+    char* buff = direction == WRITE ? generate_data(size) : allocate_buffer(size);
+    for (;;){
+        ssize_t n = direction == WRITE ? write(fd, buff, size) : read(fd, buff, size);
+        if (n <= 0){
+            if (n == -1 && errno == EINTR) continue;
+            exit(EXIT_FAILURE);
+        }
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+    }
+}
+
+/* Fork one worker on channel, given either as a pipe or as a FIFO path to open */
+pid_t scale_spawn(int* fd, const char* fifo_name, int direction, size_t size, _Atomic unsigned long long* counter){
+    pid_t pid = fork();
+    if (pid < 0){
+        perror("ERROR: Fork failed. \n");
+    }
+    else if (pid == 0){
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        int channel;
+        if (fifo_name != NULL){
+            channel = open(fifo_name, direction == WRITE ? O_WRONLY : O_RDONLY);
+            if (channel == -1){
+                perror("ERROR: Opening pipe-file failed. \n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            close(fd[direction == WRITE ? READ : WRITE]);
+            channel = fd[direction];
+        }
+        scale_worker(channel, direction, size, counter);
+    }
+    return pid;
+}
+
+/* Run one combination of writers and readers, and print a line per process plus the aggregate */
+int scale_run(struct scale_options* options, int writers, int readers, _Atomic unsigned long long* counters){
+    int channels = options->independent ? writers : 1;
+    int named = strcmp(options->transport, "named") == 0;
+    pid_t pids[SCALE_MAX_PROCESSES];
+    int processes = 0;
+    char fifo_name[64];
+
+    for (int i = 0; i < writers + readers; i++) atomic_store(&counters[i], 0);
+    for (int channel = 0; channel < channels; channel++){
+        int fd[2] = {-1, -1};
+        snprintf(fifo_name, sizeof(fifo_name), "/tmp/ipc_scale_fifo_%d", channel);
+        if (named){
+            remove(fifo_name);
+            if (mkfifo(fifo_name, 0666) != 0){
+                perror("ERROR: Creating pipe-file failed. \n");
+                return -1;
+            }
+        } else if (pipe(fd) != 0){
+            perror("ERROR: Creating pipe failed. \n");
+            return -1;
+        }
+        /* A shared channel gets every process, an independent one its own writer and reader */
+        int first_writer = options->independent ? channel : 0;
+        int last_writer = options->independent ? channel + 1 : writers;
+        int first_reader = options->independent ? channel : 0;
+        int last_reader = options->independent ? channel + 1 : readers;
+        for (int i = first_writer; i < last_writer; i++){
+            pids[processes++] = scale_spawn(fd, named ? fifo_name : NULL, WRITE, options->size, &counters[i]);
+        }
+        for (int i = first_reader; i < last_reader; i++){
+            pids[processes++] = scale_spawn(fd, named ? fifo_name : NULL, READ, options->size, &counters[writers + i]);
+        }
+        if (!named){
+            close(fd[READ]);
+            close(fd[WRITE]);
+        }
+    }
+
+    sleep_seconds(options->warmup);
+    unsigned long long start_bytes[SCALE_MAX_PROCESSES];
+    for (int i = 0; i < writers + readers; i++) start_bytes[i] = atomic_load(&counters[i]);
+    double start = now_seconds();
+    sleep_seconds(options->duration);
+    double elapsed = now_seconds() - start;
+    unsigned long long end_bytes[SCALE_MAX_PROCESSES];
+    for (int i = 0; i < writers + readers; i++) end_bytes[i] = atomic_load(&counters[i]);
+
+    for (int i = 0; i < processes; i++){
+        if (pids[i] > 0) kill(pids[i], SIGKILL);
+    }
+    for (int i = 0; i < processes; i++){
+        if (pids[i] > 0) waitpid(pids[i], NULL, 0);
+    }
+    if (named){
+        for (int channel = 0; channel < channels; channel++){
+            snprintf(fifo_name, sizeof(fifo_name), "/tmp/ipc_scale_fifo_%d", channel);
+            remove(fifo_name);
+        }
+    }
+
+    /* Aggregate bandwidth is what arrived at the readers */
+    double aggregate = 0;
+    const char* layout = options->independent ? "independent" : "shared";
+    for (int i = 0; i < writers + readers; i++){
+        int reader = i >= writers;
+        double bandwidth = (end_bytes[i] - start_bytes[i]) / elapsed;
+        if (reader) aggregate += bandwidth;
+        printf("%s,%s,%d,%d,%zu,%s,%d,%.0f\n", options->transport, layout, writers, readers,
+            options->size, reader ? "reader" : "writer", reader ? i - writers : i, bandwidth);
+    }
+    printf("%s,%s,%d,%d,%zu,aggregate,,%.0f\n", options->transport, layout, writers, readers, options->size, aggregate);
+    fflush(stdout);
+    return 0;
+}
+
+void scale_usage(){
+    printf("Usage: main --scale [options]\n");
+    printf("  -t, --transport NAME   unnamed or named, default unnamed\n");
+    printf("  -n, --writers LIST     comma separated writer counts, default 1,2,4\n");
+    printf("  -m, --readers LIST     comma separated reader counts, default 1,2,4\n");
+    printf("  -i, --independent      one channel with its own reader per writer, instead of one shared channel\n");
+    printf("  -s, --size SIZE        block size, default 10000\n");
+    printf("  -w, --warmup SECONDS   warm-up before measuring, default 0.5\n");
+    printf("  -d, --duration SECONDS measuring time per combination, default 2\n");
+}
+
+int scale(int argc, char *argv[]){
+    struct scale_options options = {
+        .writers = "1,2,4", .readers = "1,2,4", .transport = "unnamed",
+        .independent = 0, .size = 10000, .warmup = 0.5, .duration = 2
+    };
+    static struct option long_options[] = {
+        {"transport", required_argument, 0, 't'},
+        {"writers", required_argument, 0, 'n'},
+        {"readers", required_argument, 0, 'm'},
+        {"independent", no_argument, 0, 'i'},
+        {"size", required_argument, 0, 's'},
+        {"warmup", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 'd'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "t:n:m:is:w:d:h", long_options, NULL)) != -1){
+        switch (option){
+            case 't': options.transport = optarg; break;
+            case 'n': options.writers = optarg; break;
+            case 'm': options.readers = optarg; break;
+            case 'i': options.independent = 1; break;
+            case 's': options.size = strtoull(optarg, NULL, 10); break;
+            case 'w': options.warmup = atof(optarg); break;
+            case 'd': options.duration = atof(optarg); break;
+            default: scale_usage(); return option == 'h' ? 0 : 1;
+        }
+    }
+    if ((strcmp(options.transport, "unnamed") != 0 && strcmp(options.transport, "named") != 0) ||
+        options.size == 0 || options.duration <= 0){
+        scale_usage();
+        return 1;
+    }
+
+    _Atomic unsigned long long* counters = mmap(NULL, SCALE_MAX_PROCESSES * sizeof(*counters),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counters == MAP_FAILED){
+        perror("ERROR: mmap failed");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("transport,channels,writers,readers,block_size,process,index,bps\n");
+    fflush(stdout);
+    char* writer_counts = strdup(options.writers);
+    char* writer_save;
+    for (char* w = strtok_r(writer_counts, ",", &writer_save); w != NULL; w = strtok_r(NULL, ",", &writer_save)){
+        int writers = atoi(w);
+        /* Independent channels pair every writer with a reader, so there is nothing to vary */
+        char* reader_counts = strdup(options.independent ? w : options.readers);
+        char* reader_save;
+        for (char* r = strtok_r(reader_counts, ",", &reader_save); r != NULL; r = strtok_r(NULL, ",", &reader_save)){
+            int readers = atoi(r);
+            if (writers < 1 || readers < 1 || writers + readers > SCALE_MAX_PROCESSES){
+                printf("Unsupported combination: %d writers, %d readers\n", writers, readers);
+                continue;
+            }
+            scale_run(&options, writers, readers, counters);
+        }
+        free(reader_counts);
+    }
+    free(writer_counts);
+    munmap(counters, SCALE_MAX_PROCESSES * sizeof(*counters));
+    return 0;
+}
+/* Framed mode
+ * Sends many small messages of varying size instead of one block size forever. Every message is
+ * a 4 byte length followed by its payload, with sizes drawn from a distribution:
+ *   N       every message N bytes
+ *   A-B     uniform between A and B bytes
+ *   expN    exponential with mean N bytes, capped at 16 times the mean
+ * The writer coalesces messages into one writev, until the batch holds batch_bytes, the iovec
+ * array is full, or the oldest message in it has waited deadline microseconds. A batch size of
+ * 0 writes every message on its own, like the 1-100 byte rows of the tables. The reader parses
+ * the frames out of large reads. Both message rate and byte bandwidth are reported.
+ */
+#define FRAMED_SIZES 4096           /* precomputed sizes, cycled through */
+#define FRAMED_READ_SIZE (1 << 20)
+#define FRAMED_MAX_IOV 1024         /* IOV_MAX on Linux, two per message */
+
+struct framed_counters {
+    _Atomic unsigned long long messages;    /* parsed by the reader */
+    _Atomic unsigned long long bytes;       /* payload bytes parsed by the reader */
+    _Atomic unsigned long long writes;      /* writev calls by the writer */
+};
+
+/* Fill sizes from a distribution spec. Returns the largest size, or 0 if the spec is not valid. */
+uint32_t framed_sizes(const char* spec, uint32_t* sizes){
+    unsigned long a, b;
+    uint32_t max = 0;
+    unsigned int seed = 1;
+    char end;
+    if (sscanf(spec, "exp%lu%c", &a, &end) == 1 && a > 0){
+        for (int i = 0; i < FRAMED_SIZES; i++){
+            double u = (rand_r(&seed) + 1.0) / ((double)RAND_MAX + 2.0);
+            double size = -log(u) * a;
+            sizes[i] = size < 1 ? 1 : size > 16.0 * a ? 16 * a : (uint32_t)size;
+        }
+    } else if (sscanf(spec, "%lu-%lu%c", &a, &b, &end) == 2 && a > 0 && b >= a){
+        for (int i = 0; i < FRAMED_SIZES; i++){
+            sizes[i] = a + rand_r(&seed) % (b - a + 1);
+        }
+    } else if (sscanf(spec, "%lu%c", &a, &end) == 1 && a > 0){
+        for (int i = 0; i < FRAMED_SIZES; i++) sizes[i] = a;
+    } else {
+        return 0;
+    }
+    for (int i = 0; i < FRAMED_SIZES; i++){
+        if (sizes[i] > max) max = sizes[i];
+    }
+    return max;
+}
+
+/* Write all of iov, continuing after partial writes */
+int writev_all(int fd, struct iovec* iov, int count){
+    while (count > 0){
+        ssize_t w = writev(fd, iov, count);
+        if (w == -1){
+            if (errno == EINTR) continue;
+            perror("ERROR: writev failed");
+            return -1;
+        }
+        while (count > 0 && (size_t)w >= iov->iov_len){
+            w -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0){
+            iov->iov_base = (char*)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+void framed_writer(int fd, uint32_t* sizes, uint32_t max_size, size_t batch_bytes, long deadline_us, struct framed_counters* counters){
+    char* payload = generate_data(max_size);
+    uint32_t headers[FRAMED_MAX_IOV / 2];
+    struct iovec iov[FRAMED_MAX_IOV];
+    int messages = 0;
+    size_t batched = 0;
+    uint64_t oldest = 0;
+    for (unsigned long i = 0;; i++){
+        uint32_t size = sizes[i % FRAMED_SIZES];
+        if (messages == 0 && deadline_us > 0) oldest = now_nanoseconds();
+        headers[messages] = size;
+        iov[2 * messages].iov_base = &headers[messages];
+        iov[2 * messages].iov_len = sizeof(uint32_t);
+        iov[2 * messages + 1].iov_base = payload;
+        iov[2 * messages + 1].iov_len = size;
+        messages++;
+        batched += sizeof(uint32_t) + size;
+        if (batched >= batch_bytes || messages == FRAMED_MAX_IOV / 2 ||
+            (deadline_us > 0 && now_nanoseconds() - oldest >= deadline_us * 1000ULL)){
+            if (writev_all(fd, iov, 2 * messages) != 0) exit(EXIT_FAILURE);
+            atomic_fetch_add_explicit(&counters->writes, 1, memory_order_relaxed);
+            messages = 0;
+            batched = 0;
+        }
+    }
+}
+
+void framed_reader(int fd, struct framed_counters* counters){
+    char* buff = malloc(FRAMED_READ_SIZE);
+    uint32_t length = 0;
+    size_t header_read = 0;     /* bytes of the current length seen so far */
+    size_t payload_left = 0;    /* bytes of the current payload still to come */
+    while (1){
+        ssize_t r = read(fd, buff, FRAMED_READ_SIZE);
+        if (r <= 0){
+            if (r == -1 && errno == EINTR) continue;
+            exit(r == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        unsigned long long messages = 0, bytes = 0;
+        char* position = buff;
+        char* end = buff + r;
+        while (position < end){
+            if (payload_left > 0){
+                size_t chunk = end - position < (ssize_t)payload_left ? (size_t)(end - position) : payload_left;
+                position += chunk;
+                payload_left -= chunk;
+                bytes += chunk;
+                if (payload_left == 0) messages++;
+                continue;
+            }
+            /* The length may be split across two reads */
+            size_t chunk = sizeof(uint32_t) - header_read;
+            if (chunk > (size_t)(end - position)) chunk = end - position;
+            memcpy((char*)&length + header_read, position, chunk);
+            position += chunk;
+            header_read += chunk;
+            if (header_read == sizeof(uint32_t)){
+                header_read = 0;
+                payload_left = length;
+                if (length == 0) messages++;
+            }
+        }
+        atomic_fetch_add_explicit(&counters->messages, messages, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->bytes, bytes, memory_order_relaxed);
+    }
+}
+
+/* Run one distribution and batch size, and print its line */
+int framed_run(const char* transport, const char* spec, size_t batch_bytes, long deadline_us,
+               double warmup, double duration, struct framed_counters* counters){
+    uint32_t* sizes = malloc(sizeof(uint32_t) * FRAMED_SIZES);
+    uint32_t max_size = framed_sizes(spec, sizes);
+    if (max_size == 0){
+        printf("Unknown size distribution: %s\n", spec);
+        free(sizes);
+        return -1;
+    }
+    const char* fifo_name = "/tmp/fifo_framed";
+    int named = strcmp(transport, "named") == 0;
+    int fd[2] = {-1, -1};
+    if (named){
+        remove(fifo_name);
+        if (mkfifo(fifo_name, 0666) != 0){
+            perror("ERROR: Creating pipe-file failed. \n");
+            return -1;
+        }
+    } else if (pipe(fd) != 0){
+        perror("ERROR: Creating pipe failed. \n");
+        return -1;
+    }
+    if (!named) set_pipe_capacity(fd[READ]);
+    memset(counters, 0, sizeof(*counters));
+
+    pid_t pids[2];
+    for (int side = READ; side <= WRITE; side++){
+        pids[side] = fork();
+        if (pids[side] < 0){
+            perror("ERROR: Fork failed. \n");
+            exit(EXIT_FAILURE);
+        }
+        if (pids[side] == 0){
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            pin_side(side);
+            int channel;
+            if (named){
+                channel = open(fifo_name, side == READ ? O_RDONLY : O_WRONLY);
+                if (channel == -1){
+                    perror("ERROR: file open failed");
+                    exit(EXIT_FAILURE);
+                }
+                if (side == READ) set_pipe_capacity(channel);
+            } else {
+                close(fd[side == READ ? WRITE : READ]);
+                channel = fd[side];
+            }
+            if (side == READ) framed_reader(channel, counters);
+            else framed_writer(channel, sizes, max_size, batch_bytes, deadline_us, counters);
+            exit(EXIT_SUCCESS);
+        }
+    }
+    if (!named){
+        close(fd[READ]);
+        close(fd[WRITE]);
+    }
+
+    sleep_seconds(warmup);
+    unsigned long long start_messages = atomic_load(&counters->messages);
+    unsigned long long start_bytes = atomic_load(&counters->bytes);
+    unsigned long long start_writes = atomic_load(&counters->writes);
+    double start = now_seconds();
+    sleep_seconds(duration);
+    double elapsed = now_seconds() - start;
+    unsigned long long messages = atomic_load(&counters->messages) - start_messages;
+    unsigned long long bytes = atomic_load(&counters->bytes) - start_bytes;
+    unsigned long long writes = atomic_load(&counters->writes) - start_writes;
+
+    for (int side = WRITE; side >= READ; side--){   /* writer first, so it does not see a broken pipe */
+        kill(pids[side], SIGKILL);
+        waitpid(pids[side], NULL, 0);
+    }
+    if (named) remove(fifo_name);
+    free(sizes);
+
+    printf("%s,%s,%zu,%ld,%llu,%.0f,%.0f,%.1f\n", transport, spec, batch_bytes, deadline_us,
+        messages, messages / elapsed, bytes / elapsed, writes > 0 ? (double)messages / writes : 0.0);
+    fflush(stdout);
+    return 0;
+}
+
+void framed_usage(){
+    printf("Usage: main --framed [options]\n");
+    printf("  -t, --transport NAME   unnamed or named, default unnamed\n");
+    printf("  -s, --sizes LIST       comma separated size distributions N, A-B or expN, default 1,1-100,exp64\n");
+    printf("  -b, --batch LIST       comma separated writev batch sizes in bytes, 0 writes every message alone, default 0,4096,65536\n");
+    printf("  -l, --deadline US      longest a message waits in a batch, 0 for no limit, default 1000\n");
+    printf("  -w, --warmup SECONDS   warm-up before measuring, default 0.5\n");
+    printf("  -d, --duration SECONDS measuring time per combination, default 2\n");
+}
+
+int framed(int argc, char *argv[]){
+    const char* transport = "unnamed";
+    char* sizes_option = "1,1-100,exp64";
+    char* batches_option = "0,4096,65536";
+    long deadline_us = 1000;
+    double warmup = 0.5, duration = 2;
+    static struct option long_options[] = {
+        {"transport", required_argument, 0, 't'},
+        {"sizes", required_argument, 0, 's'},
+        {"batch", required_argument, 0, 'b'},
+        {"deadline", required_argument, 0, 'l'},
+        {"warmup", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 'd'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "t:s:b:l:w:d:h", long_options, NULL)) != -1){
+        switch (option){
+            case 't': transport = optarg; break;
+            case 's': sizes_option = optarg; break;
+            case 'b': batches_option = optarg; break;
+            case 'l': deadline_us = atol(optarg); break;
+            case 'w': warmup = atof(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            default: framed_usage(); return option == 'h' ? 0 : 1;
+        }
+    }
+    if ((strcmp(transport, "unnamed") != 0 && strcmp(transport, "named") != 0) || duration <= 0 || deadline_us < 0){
+        framed_usage();
+        return 1;
+    }
+    struct framed_counters* counters = mmap(NULL, sizeof(struct framed_counters), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counters == MAP_FAILED){
+        perror("ERROR: mmap failed");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("transport,sizes,batch_bytes,deadline_us,messages,messages_per_s,payload_bps,messages_per_write\n");
+    fflush(stdout);
+    char* specs = strdup(sizes_option);
+    char* spec_save;
+    for (char* spec = strtok_r(specs, ",", &spec_save); spec != NULL; spec = strtok_r(NULL, ",", &spec_save)){
+        char* batches = strdup(batches_option);
+        char* batch_save;
+        for (char* batch = strtok_r(batches, ",", &batch_save); batch != NULL; batch = strtok_r(NULL, ",", &batch_save)){
+            framed_run(transport, spec, strtoull(batch, NULL, 10), deadline_us, warmup, duration, counters);
+        }
+        free(batches);
+    }
+    free(specs);
+    munmap(counters, sizeof(struct framed_counters));
+    return 0;
+}
+
+/* Fan-in mode
+ * One reader draining K pipes or FIFOs, each with its own forked writer, like an aggregator
+ * reading from many producers. The read ends are non-blocking and watched by an edge-triggered
+ * epoll, so every readiness event is followed by reads until EAGAIN. The reader is this process,
+ * counting bytes per channel, and reports the aggregate bandwidth together with how evenly it was
+ * spread over the channels: the slowest and fastest channel, Jain's fairness index
+ * (1 is perfectly even, 1/K is one channel getting everything) and the channels that got nothing.
+ */
+struct fanin_options {
+    const char* transport;  /* unnamed or named */
+    char* channels;         /* comma separated channel counts */
+    size_t size;
+    double warmup;
+    double duration;
+};
+
+/* Drain ready channels until the deadline, adding what each delivered to bytes[channel] */
+void fanin_drain(int epoll, char* buff, size_t size, int* fds, unsigned long long* bytes, double deadline){
+    struct epoll_event events[256];
+    while (now_seconds() < deadline){
+        int ready = epoll_wait(epoll, events, 256, 10);
+        if (ready == -1){
+            if (errno == EINTR) continue;
+            perror("ERROR: epoll_wait failed");
+            return;
+        }
+        for (int i = 0; i < ready; i++){
+            int channel = events[i].data.u32;
+            ssize_t r;
+            while ((r = read(fds[channel], buff, size)) > 0){  /* edge-triggered, so read until it is empty */
+                bytes[channel] += r;
+            }
+            if (r == -1 && errno != EAGAIN){
+                perror("ERROR: read failed");
+            }
+        }
+    }
+}
+
+/* Run K channels, and print their line */
+int fanin_run(struct fanin_options* options, int channels){
+    int named = strcmp(options->transport, "named") == 0;
+    int* fds = malloc(sizeof(int) * channels);
+    pid_t* pids = malloc(sizeof(pid_t) * channels);
+    unsigned long long* bytes = calloc(channels, sizeof(unsigned long long));
+    char fifo_name[64];
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll == -1){
+        perror("ERROR: epoll_create1 failed");
+        return -1;
+    }
+
+    int started = 0;
+    for (; started < channels; started++){
+        int fd[2] = {-1, -1};
+        if (named){
+            snprintf(fifo_name, sizeof(fifo_name), "/tmp/ipc_fanin_fifo_%d", started);
+            remove(fifo_name);
+            /* Open the read end first, without blocking, so the writer's open finds a reader */
+            if (mkfifo(fifo_name, 0666) != 0 || (fd[READ] = open(fifo_name, O_RDONLY | O_NONBLOCK)) == -1){
+                perror("ERROR: Creating pipe-file failed. \n");
+                break;
+            }
+        } else if (pipe(fd) != 0){
+            perror("ERROR: Creating pipe failed. \n");
+            break;
+        }
+        set_pipe_capacity(fd[READ]);
+        pids[started] = fork();
+        if (pids[started] < 0){
+            perror("ERROR: Fork failed. \n");
+            close(fd[READ]);
+            if (!named) close(fd[WRITE]);
+            break;
+        }
+        if (pids[started] == 0){    /* writer, blocking writes forever */
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            pin_side(WRITE);
+            close(fd[READ]);
+            int channel = named ? open(fifo_name, O_WRONLY) : fd[WRITE];
+            char* dummy_data = generate_data(options->size);
+            while (write(channel, dummy_data, options->size) > 0);
+            exit(EXIT_FAILURE);
+        }
+        if (!named) close(fd[WRITE]);
+        fcntl(fd[READ], F_SETFL, O_NONBLOCK);
+        fds[started] = fd[READ];
+        struct epoll_event event = { .events = EPOLLIN | EPOLLET, .data.u32 = started };
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd[READ], &event) == -1){
+            perror("ERROR: epoll_ctl failed");
+        }
+    }
+
+    pin_side(READ);
+    char* buff = allocate_buffer(options->size);
+    fanin_drain(epoll, buff, options->size, fds, bytes, now_seconds() + options->warmup);
+    memset(bytes, 0, sizeof(unsigned long long) * channels);
+    double start = now_seconds();
+    fanin_drain(epoll, buff, options->size, fds, bytes, start + options->duration);
+    double elapsed = now_seconds() - start;
+
+    for (int i = 0; i < started; i++) kill(pids[i], SIGKILL);
+    for (int i = 0; i < started; i++){
+        waitpid(pids[i], NULL, 0);
+        close(fds[i]);
+        if (named){
+            snprintf(fifo_name, sizeof(fifo_name), "/tmp/ipc_fanin_fifo_%d", i);
+            remove(fifo_name);
+        }
+    }
+    close(epoll);
+
+    if (started > 0){
+        double total = 0, squares = 0, min = -1, max = 0;
+        int starved = 0;
+        for (int i = 0; i < started; i++){
+            double bandwidth = bytes[i] / elapsed;
+            total += bandwidth;
+            squares += bandwidth * bandwidth;
+            if (min < 0 || bandwidth < min) min = bandwidth;
+            if (bandwidth > max) max = bandwidth;
+            if (bytes[i] == 0) starved++;
+        }
+        double fairness = squares > 0 ? total * total / (started * squares) : 0;
+        printf("%s,%d,%zu,%.0f,%.0f,%.0f,%.4f,%d\n", options->transport, started, options->size,
+            total, min, max, fairness, starved);
+        fflush(stdout);
+    }
+    release_buffer(buff, options->size);
+    free(fds);
+    free(pids);
+    free(bytes);
+    return started == channels ? 0 : -1;
+}
+
+void fanin_usage(){
+    printf("Usage: main --fanin [options]\n");
+    printf("  -t, --transport NAME   unnamed or named, default unnamed\n");
+    printf("  -k, --channels LIST    comma separated channel counts, default 1,4,16,64,256,1024\n");
+    printf("  -s, --size SIZE        block size, default 10000\n");
+    printf("  -w, --warmup SECONDS   warm-up before measuring, default 0.5\n");
+    printf("  -d, --duration SECONDS measuring time per channel count, default 2\n");
+}
+
+int fanin(int argc, char *argv[]){
+    struct fanin_options options = {
+        .transport = "unnamed", .channels = "1,4,16,64,256,1024",
+        .size = 10000, .warmup = 0.5, .duration = 2
+    };
+    static struct option long_options[] = {
+        {"transport", required_argument, 0, 't'},
+        {"channels", required_argument, 0, 'k'},
+        {"size", required_argument, 0, 's'},
+        {"warmup", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 'd'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "t:k:s:w:d:h", long_options, NULL)) != -1){
+        switch (option){
+            case 't': options.transport = optarg; break;
+            case 'k': options.channels = optarg; break;
+            case 's': options.size = strtoull(optarg, NULL, 10); break;
+            case 'w': options.warmup = atof(optarg); break;
+            case 'd': options.duration = atof(optarg); break;
+            default: fanin_usage(); return option == 'h' ? 0 : 1;
+        }
+    }
+    if ((strcmp(options.transport, "unnamed") != 0 && strcmp(options.transport, "named") != 0) ||
+        options.size == 0 || options.duration <= 0){
+        fanin_usage();
+        return 1;
+    }
+    /* Thousands of channels need more descriptors than the usual soft limit of 1024 */
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max){
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("transport,channels,block_size,aggregate_bps,min_channel_bps,max_channel_bps,jain_fairness,starved_channels\n");
+    fflush(stdout);
+    char* counts = strdup(options.channels);
+    char* count_save;
+    for (char* count = strtok_r(counts, ",", &count_save); count != NULL; count = strtok_r(NULL, ",", &count_save)){
+        int channels = atoi(count);
+        if (channels < 1){
+            printf("Unsupported channel count: %s\n", count);
+            continue;
+        }
+        fanin_run(&options, channels);
+    }
+    free(counts);
+    return 0;
+}
+/* Threaded transports
+ * The same transports with the reader and writer as two threads of one process instead of two
+ * processes, so the difference shows what the process boundary costs: thread-unnamed,
+ * thread-named, thread-shm, thread-stream, thread-seqpacket and thread-unix.
+ * queue is the baseline for handing data between threads without the kernel: a lock-free
+ * single producer/single consumer queue of blocks. The writer copies a block in and the reader
+ * copies it out, the same two copies a pipe makes, and a side with nothing to do yields.
+ * Like the process transports they run until the process is killed.
+ */
+#define QUEUE_MEMORY (64 * 1024 * 1024)     /* at most this much in queued blocks */
+#define QUEUE_MAX_SLOTS 64
+
+struct block_queue {
+    _Alignas(CACHE_LINE) _Atomic size_t head;   /* blocks written, by the writer */
+    _Alignas(CACHE_LINE) _Atomic size_t tail;   /* blocks read, by the reader */
+    _Alignas(CACHE_LINE) size_t slots;
+    char* blocks[QUEUE_MAX_SLOTS];
+};
+
+struct thread_channel {
+    size_t size;
+    int read_fd;
+    int write_fd;
+    struct ring* ring;
+    int space_event;
+    int data_event;
+    struct block_queue* queue;
+};
+
+void* thread_writer(void* arg){
+    struct thread_channel* channel = arg;
+    size_t size = channel->size;
+    pin_side(WRITE);
+    if (channel->ring == NULL && channel->queue == NULL){
+        write_endlessly(channel->write_fd, size);
+        return NULL;
+    }
+    char* dummy_data = generate_data(size);
+    struct block_queue* queue = channel->queue;
+    while(1){
+        if (channel->ring != NULL){
+            ring_write(channel->ring, channel->space_event, channel->data_event, dummy_data, size);
+            continue;
+        }
+        size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        while (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == queue->slots){
+            sched_yield();      /* full */
+        }
+        memcpy(queue->blocks[head % queue->slots], dummy_data, size);
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void* thread_reader(void* arg){
+    struct thread_channel* channel = arg;
+    size_t size = channel->size;
+    pin_side(READ);
+    if (channel->ring == NULL && channel->queue == NULL){
+        read_endlessly(channel->read_fd, size);
+        return NULL;
+    }
+    char* buff = allocate_buffer(size);
+    struct block_queue* queue = channel->queue;
+    while(1){
+        if (channel->ring != NULL){
+            count_bytes_read(ring_read(channel->ring, channel->space_event, channel->data_event, buff, size));
+            continue;
+        }
+        size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        while (atomic_load_explicit(&queue->head, memory_order_acquire) == tail){
+            sched_yield();      /* empty */
+        }
+        memcpy(buff, queue->blocks[tail % queue->slots], size);
+        atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+        count_bytes_read(size);
+    }
+    return NULL;
+}
+
+// Establish the transport between two threads, and read/write as fast as possible through it.
+int threaded_transport(const char* transport, size_t size){
+    printf("================================\n");
+    printf("THREADS (%s)\n", transport);
+    printf("================================\n");
+    printf("Process PID: %i\n",getpid());
+    printf("================================\n");
+    const char* kind = strcmp(transport, "queue") == 0 ? transport : transport + 7;
+    struct thread_channel channel = { .size = size, .read_fd = -1, .write_fd = -1 };
+
+    /* Both ends are opened here, in one thread, so nothing may block waiting for the other side */
+    if (strcmp(kind, "unnamed") == 0){
+        int fd[2];
+        if (pipe(fd) != 0){
+            perror("ERROR: Creating pipe failed. \n");
+            return -1;
+        }
+        printf("Pipe capacity: %i\n", set_pipe_capacity(fd[READ]));
+        channel.read_fd = fd[READ];
+        channel.write_fd = fd[WRITE];
+    } else if (strcmp(kind, "named") == 0){
+        const char* pipe_name = "/tmp/fifo_pipe";
+        remove(pipe_name);
+        if (mkfifo(pipe_name, 0666) != 0){
+            perror("ERROR: Creating pipe-file failed. \n");
+            return -1;
+        }
+        /* A non-blocking open for reading does not wait for a writer, then the writer finds it */
+        channel.read_fd = open(pipe_name, O_RDONLY | O_NONBLOCK);
+        channel.write_fd = open(pipe_name, O_WRONLY);
+        if (channel.read_fd == -1 || channel.write_fd == -1){
+            perror("ERROR: file open failed");
+            return -1;
+        }
+        fcntl(channel.read_fd, F_SETFL, 0);
+        printf("Pipe capacity: %i\n", set_pipe_capacity(channel.read_fd));
+    } else if (strcmp(kind, "stream") == 0 || strcmp(kind, "seqpacket") == 0){
+        int fd[2];
+        if (socketpair(AF_UNIX, strcmp(kind, "stream") == 0 ? SOCK_STREAM : SOCK_SEQPACKET, 0, fd) != 0){
+            perror("ERROR: Creating socket pair failed. \n");
+            return -1;
+        }
+        channel.read_fd = fd[READ];
+        channel.write_fd = fd[WRITE];
+    } else if (strcmp(kind, "unix") == 0){
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+        const char* socket_name = "/tmp/ipc_socket";
+        strcpy(address.sun_path, socket_name);
+        remove(socket_name);
+        /* connect completes as soon as the listener has queued it, before the accept */
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        channel.write_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == -1 || channel.write_fd == -1 ||
+            bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+            listen(listener, 1) == -1 ||
+            connect(channel.write_fd, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+            (channel.read_fd = accept(listener, NULL, NULL)) == -1){
+            perror("ERROR: Creating socket failed. \n");
+            return -1;
+        }
+        close(listener);
+    } else if (strcmp(kind, "shm") == 0){
+        channel.ring = ring_create(&channel.space_event, &channel.data_event);
+        if (channel.ring == NULL) return -1;
+    } else if (strcmp(kind, "queue") == 0){
+        channel.queue = aligned_alloc(CACHE_LINE, sizeof(struct block_queue));
+        memset(channel.queue, 0, sizeof(struct block_queue));
+        size_t slots = size > 0 ? QUEUE_MEMORY / size : QUEUE_MAX_SLOTS;
+        channel.queue->slots = slots < 2 ? 2 : slots > QUEUE_MAX_SLOTS ? QUEUE_MAX_SLOTS : slots;
+        for (size_t i = 0; i < channel.queue->slots; i++){
+            channel.queue->blocks[i] = allocate_buffer(size);
+        }
+    } else {
+        printf("No threaded variant of: %s\n", transport);
+        return 0;
+    }
+
+    pthread_t writer, reader;
+    if (pthread_create(&writer, NULL, thread_writer, &channel) != 0 ||
+        pthread_create(&reader, NULL, thread_reader, &channel) != 0){
+        perror("ERROR: Creating threads failed");
+        return -1;
+    }
+    pthread_join(reader, NULL);     /* only returns on errors */
+    return -1;
+}
+/* Transfer buffers
+ * The data the writer sends and the buffer the reader reads into. By default they come from malloc,
+ * so large ones are touched for the first time, page fault by page fault, while being measured.
+ * The other kinds are separate mappings, faulted in before they are returned. page is rounded to
+ * whole pages, thp and hugetlb to 2 MB huge pages and aligned to them:
+ *   malloc    plain malloc, as before
+ *   page      4 kB pages, with transparent huge pages turned off for the mapping
+ *   thp       transparent huge pages, advised with MADV_HUGEPAGE
+ *   hugetlb   MAP_HUGETLB from the reserved pool (vm.nr_hugepages), falls back to thp when it is empty
+ */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* The page size the buffer is rounded and aligned to */
+size_t buffer_alignment(){
+    return strcmp(buffer_kind, "page") == 0 ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+}
+
+size_t buffer_mapping_size(size_t size){
+    size_t alignment = buffer_alignment();
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+int valid_buffer_kind(const char* kind){
+    return strcmp(kind, "malloc") == 0 || strcmp(kind, "page") == 0 ||
+           strcmp(kind, "thp") == 0 || strcmp(kind, "hugetlb") == 0;
+}
+
+char* allocate_buffer(size_t size){
+    if (strcmp(buffer_kind, "malloc") == 0) return malloc(size);
+    size_t length = buffer_mapping_size(size);
+    char* buffer = MAP_FAILED;
+    if (strcmp(buffer_kind, "hugetlb") == 0){
+        buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (buffer == MAP_FAILED){
+            perror("MAP_HUGETLB failed, using transparent huge pages");
+        }
+    }
+    if (buffer == MAP_FAILED){
+        /* Map one page extra, so the buffer can start on a page boundary of the size we want */
+        size_t alignment = buffer_alignment();
+        char* mapping = mmap(NULL, length + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED){
+            perror("ERROR: Allocating buffer failed");
+            return NULL;
+        }
+        buffer = (char*)(((uintptr_t)mapping + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        if (buffer > mapping) munmap(mapping, buffer - mapping);
+        munmap(buffer + length, mapping + alignment - buffer);
+        madvise(buffer, length, strcmp(buffer_kind, "page") == 0 ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+        /* Fault everything in now, rather than on first touch while measuring */
+        for (size_t i = 0; i < length; i += 4096) buffer[i] = 0;
+    }
+    return buffer;
+}
+
+void release_buffer(char* buffer, size_t size){
+    if (strcmp(buffer_kind, "malloc") == 0) free(buffer);
+    else if (buffer != NULL) munmap(buffer, buffer_mapping_size(size));
+}
+
 /* Generate some random data to be communicated through a pipe */
 char* generate_data(size_t size){
-    char *p = malloc(size);
+    char *p = allocate_buffer(size);
     for (int i=0; i<size;i++){
         p[i] = 'a';  // Arbritary data
     }